@@ -0,0 +1,375 @@
+// Microbenchmarks of every decoding stage and end-to-end decodes of a corpus, see
+// bench/README.md.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bit_reader.h"
+#include "color.h"
+#include "decoder.h"
+#include "huffman.h"
+#include "idct.h"
+#include "jpeg.h"
+#include "mapped_file.h"
+#include "png_encoder.hpp"
+
+namespace {
+
+// Appends bits MSB first and byte-stuffs the result like an encoder.
+class BitWriter {
+public:
+    void Put(uint32_t bits, int count) {
+        for (int i = count - 1; i >= 0; --i) {
+            byte_ = (byte_ << 1) | ((bits >> i) & 1);
+            if (++filled_ == 8) {
+                Flush();
+            }
+        }
+    }
+
+    std::vector<uint8_t> Finish() {
+        while (filled_) {
+            Put(1, 1);
+        }
+        return std::move(data_);
+    }
+
+private:
+    void Flush() {
+        data_.push_back(byte_);
+        if (byte_ == 0xFF) {
+            data_.push_back(0);
+        }
+        byte_ = 0;
+        filled_ = 0;
+    }
+
+    std::vector<uint8_t> data_;
+    uint8_t byte_ = 0;
+    int filled_ = 0;
+};
+
+// Code lengths of the luminance AC table of Annex K.3 of the standard, what most encoders
+// use. The symbols start like there and continue in run/size order.
+const std::vector<uint8_t> kAcLengths = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+
+std::vector<uint8_t> AcValues() {
+    std::vector<uint8_t> values = {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
+                                   0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
+                                   0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+                                   0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+                                   0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a};
+    // The rest of the 162 symbols: every run 0-15 with sizes 1-10 not listed yet.
+    for (int run = 0; run < 16; ++run) {
+        for (int size = 1; size <= 10; ++size) {
+            uint8_t symbol = run << 4 | size;
+            if (std::find(values.begin(), values.end(), symbol) == values.end()) {
+                values.push_back(symbol);
+            }
+        }
+    }
+    return values;
+}
+
+// |count| symbols of the table with their extra bits, drawn so that short codes are the
+// most frequent ones like in real scans.
+std::vector<uint8_t> HuffmanStream(const std::vector<uint8_t>& lengths,
+                                   const std::vector<uint8_t>& values, size_t count) {
+    struct Code {
+        uint32_t bits;
+        int length;
+        int size;
+    };
+    std::vector<Code> codes;
+    uint32_t code = 0;
+    size_t index = 0;
+    for (int length = 1; length <= 16; ++length) {
+        for (int i = 0; i < lengths[length - 1]; ++i) {
+            codes.push_back({code++, length, values[index++] & 15});
+        }
+        code <<= 1;
+    }
+
+    std::mt19937 rng(1);
+    std::geometric_distribution<size_t> pick(0.15);
+    BitWriter writer;
+    for (size_t i = 0; i < count; ++i) {
+        const auto& symbol = codes[std::min(pick(rng), codes.size() - 1)];
+        writer.Put(symbol.bits, symbol.length);
+        writer.Put(rng(), symbol.size);
+    }
+    return writer.Finish();
+}
+
+void BM_HuffmanDecodeCoeff(benchmark::State& state) {
+    constexpr size_t kSymbols = 1 << 16;
+    auto values = AcValues();
+    HuffmanTree tree;
+    tree.Build(kAcLengths, values);
+    auto stream = HuffmanStream(kAcLengths, values, kSymbols);
+
+    for (auto _ : state) {
+        BitReader reader(stream.data(), stream.size());
+        int sum = 0;
+        for (size_t i = 0; i < kSymbols; ++i) {
+            int coeff;
+            sum += tree.DecodeCoeff(reader, coeff) + coeff;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * kSymbols);
+    state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_HuffmanDecodeCoeff);
+
+void BM_BitReader(benchmark::State& state) {
+    constexpr size_t kReads = 1 << 16;
+    std::mt19937 rng(2);
+    BitWriter writer;
+    std::vector<int> counts(kReads);
+    for (auto& count : counts) {
+        count = 1 + rng() % 16;
+        writer.Put(rng(), count);
+    }
+    auto stream = writer.Finish();
+
+    for (auto _ : state) {
+        BitReader reader(stream.data(), stream.size());
+        uint32_t sum = 0;
+        for (int count : counts) {
+            sum += reader.GetBits(count);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_BitReader);
+
+// Blocks of dequantized coefficients: the first |nonzero| of every block in zigzag order
+// are set, as after the entropy decoder.
+std::vector<int32_t> Blocks(size_t count, int nonzero) {
+    std::mt19937 rng(3);
+    std::vector<int32_t> blocks(count * kMatrixSquare, 0);
+    for (size_t block = 0; block < count; ++block) {
+        for (int k = 0; k < nonzero; ++k) {
+            int range = k ? 64 : 1024;
+            blocks[block * kMatrixSquare + kZigzagToNatural[k]] =
+                static_cast<int32_t>(rng() % (2 * range)) - range;
+        }
+    }
+    return blocks;
+}
+
+// DequantizeBlock, which LoadMcuRow runs on every block of a progressive file.
+void BM_Dequantize(benchmark::State& state) {
+    constexpr size_t kBlocks = 1024;
+    std::mt19937 rng(4);
+    std::vector<int16_t> zigzag(kBlocks * kMatrixSquare);
+    for (auto& coeff : zigzag) {
+        coeff = static_cast<int16_t>(rng() % 64) - 32;
+    }
+    QuantTable table;
+    for (size_t i = 0; i < kMatrixSquare; ++i) {
+        table.data_[i] = 1 + i / 2;
+    }
+    std::vector<int32_t> natural(kBlocks * kMatrixSquare);
+
+    for (auto _ : state) {
+        for (size_t block = 0; block < kBlocks; ++block) {
+            int last = DequantizeBlock(zigzag.data() + block * kMatrixSquare, table.data_,
+                                       natural.data() + block * kMatrixSquare);
+            benchmark::DoNotOptimize(last);
+        }
+        benchmark::DoNotOptimize(natural.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kBlocks);
+}
+BENCHMARK(BM_Dequantize);
+
+// Args: backend, nonzero coefficients per block (1 takes the DC-only shortcut).
+void BM_Idct(benchmark::State& state) {
+    auto backend = static_cast<IdctBackend>(state.range(0));
+    int nonzero = state.range(1);
+    if (!Idct::IsSupported(backend)) {
+        state.SkipWithError("backend not supported");
+        return;
+    }
+    state.SetLabel(IdctBackendName(backend));
+
+    constexpr size_t kBlocks = 1024;
+    Idct idct(backend);
+    auto blocks = Blocks(kBlocks, nonzero);
+    uint8_t samples[kMatrixSquare];
+
+    for (auto _ : state) {
+        for (size_t block = 0; block < kBlocks; ++block) {
+            idct.Inverse(blocks.data() + block * kMatrixSquare, samples, kMatrixSide,
+                         kMatrixSide, nonzero - 1);
+        }
+        benchmark::DoNotOptimize(samples);
+    }
+    state.SetItemsProcessed(state.iterations() * kBlocks);
+}
+BENCHMARK(BM_Idct)
+    ->ArgsProduct({{static_cast<int>(IdctBackend::kScalar), static_cast<int>(IdctBackend::kSse2),
+                    static_cast<int>(IdctBackend::kAvx2), static_cast<int>(IdctBackend::kFftw)},
+                   {1, 10, 64}});
+
+// Arg: chroma shift, 0 for 4:4:4 and 1 for 2x horizontally subsampled chroma.
+void BM_YCbCrToRgbRow(benchmark::State& state) {
+    constexpr size_t kWidth = 1920;
+    int shift = state.range(0);
+    std::mt19937 rng(5);
+    std::vector<uint8_t> y(kWidth), cb(kWidth), cr(kWidth), out(3 * kWidth);
+    for (size_t i = 0; i < kWidth; ++i) {
+        y[i] = rng();
+        cb[i] = rng();
+        cr[i] = rng();
+    }
+
+    for (auto _ : state) {
+        YCbCrToRgbRow(y.data(), cb.data(), cr.data(), kWidth, shift, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kWidth);
+}
+BENCHMARK(BM_YCbCrToRgbRow)->Arg(0)->Arg(1);
+
+void BM_FancyUpsampleH2V2(benchmark::State& state) {
+    constexpr size_t kCount = 960;
+    std::mt19937 rng(6);
+    // One padding sample on each side, see FancyUpsampleH2V2.
+    std::vector<uint8_t> near(kCount + 2), far(kCount + 2), out(2 * kCount);
+    for (size_t i = 0; i < kCount + 2; ++i) {
+        near[i] = rng();
+        far[i] = rng();
+    }
+
+    for (auto _ : state) {
+        FancyUpsampleH2V2(near.data() + 1, far.data() + 1, kCount, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * kCount);
+}
+BENCHMARK(BM_FancyUpsampleH2V2);
+
+// Args: zlib level, PngFilter.
+void BM_WritePng(benchmark::State& state) {
+    constexpr size_t kWidth = 640;
+    constexpr size_t kHeight = 480;
+    Image image(kWidth, kHeight);
+    for (size_t y = 0; y < kHeight; ++y) {
+        uint8_t* row = image.Row(y);
+        for (size_t x = 0; x < kWidth; ++x) {
+            row[3 * x] = x;
+            row[3 * x + 1] = y;
+            row[3 * x + 2] = (x / 16 + y / 16) % 2 * 200;
+        }
+    }
+    PngOptions options;
+    options.compression_level = state.range(0);
+    options.filter = static_cast<PngFilter>(state.range(1));
+    auto path = (std::filesystem::temp_directory_path() / "decoder_bench.png").string();
+
+    for (auto _ : state) {
+        WritePng(path, image, options);
+    }
+    std::filesystem::remove(path);
+    state.SetBytesProcessed(state.iterations() * kWidth * kHeight * 3);
+}
+BENCHMARK(BM_WritePng)
+    ->Args({1, static_cast<int>(PngFilter::kNone)})
+    ->Args({6, static_cast<int>(PngFilter::kDefault)})
+    ->Unit(benchmark::kMillisecond);
+
+// Drops the rows, so only the decoder is measured.
+class NullSink : public RowSink {
+public:
+    void Begin(const ImageHeader& header) override {
+        header_ = header;
+    }
+
+    void WriteRow(size_t, std::span<const uint8_t> row) override {
+        benchmark::DoNotOptimize(row.data());
+    }
+
+    ImageHeader header_;
+};
+
+// Decodes one file of the corpus with a reused scratch, as a batch worker would.
+void DecodeFile(benchmark::State& state, const std::string& path, DecodeOptions options) {
+    MappedFile file(path);
+    DecodeScratch scratch;
+    options.scratch = &scratch;
+    NullSink sink;
+
+    for (auto _ : state) {
+        DecodeRows(file.Data(), sink, options);
+    }
+
+    double megapixels = sink.header_.width * sink.header_.height / 1e6;
+    double megabytes = file.Data().size() / 1e6;
+    state.counters["MP"] =
+        benchmark::Counter(megapixels * state.iterations(), benchmark::Counter::kIsRate);
+    state.counters["MB"] =
+        benchmark::Counter(megabytes * state.iterations(), benchmark::Counter::kIsRate);
+}
+
+void RegisterCorpus(const std::filesystem::path& dir) {
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() == ".jpg") {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const auto& file : files) {
+        std::string name = file.stem().string();
+        benchmark::RegisterBenchmark(("Decode/" + name).c_str(), DecodeFile, file.string(),
+                                     DecodeOptions{})
+            ->Unit(benchmark::kMillisecond);
+        DecodeOptions fancy;
+        fancy.upsampling = Upsampling::kFancy;
+        benchmark::RegisterBenchmark(("DecodeFancy/" + name).c_str(), DecodeFile, file.string(),
+                                     fancy)
+            ->Unit(benchmark::kMillisecond);
+        for (size_t scale : {2, 4, 8}) {
+            DecodeOptions scaled;
+            scaled.scale = scale;
+            std::string label = "DecodeScaled/" + name + "/" + std::to_string(scale);
+            benchmark::RegisterBenchmark(label.c_str(), DecodeFile, file.string(), scaled)
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+}
+
+}  // namespace
+
+// Takes --corpus=DIR besides the Google Benchmark flags, bench/corpus by default.
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+
+    std::string corpus = DECODER_BENCH_CORPUS_DIR;
+    const std::string flag = "--corpus=";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], flag.c_str(), flag.size()) == 0) {
+            corpus = argv[i] + flag.size();
+        } else {
+            benchmark::ReportUnrecognizedArguments(argc, argv);
+            return 1;
+        }
+    }
+    RegisterCorpus(corpus);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
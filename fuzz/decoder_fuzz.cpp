@@ -0,0 +1,273 @@
+// libFuzzer target for the decoder, see fuzz/README.md.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "FuzzDataProvider.h"
+#include "decoder.h"
+#include "thread_pool.h"
+
+namespace {
+
+// DecodeLimits of every input, so one stays within milliseconds and a few megabytes.
+constexpr size_t kMaxPixels = 1 << 20;
+constexpr size_t kMaxMemory = 64 << 20;
+
+class NullSink : public RowSink {
+public:
+    void Begin(const ImageHeader&) override {
+    }
+
+    void WriteRow(size_t, std::span<const uint8_t>) override {
+    }
+};
+
+void PutSegment(std::vector<uint8_t>& out, uint8_t marker, const std::vector<uint8_t>& payload) {
+    size_t length = payload.size() + 2;
+    out.insert(out.end(), {0xFF, marker, static_cast<uint8_t>(length >> 8),
+                           static_cast<uint8_t>(length & 0xFF)});
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// Huffman table |id| of |table_class| whose codes have |length| - 1 and |length| bits and
+// cover every bit sequence but the one of |length| 1 bits, so random data rarely hits an
+// invalid code. Needs 2^(length-1) <= |symbols| < 2^length.
+std::vector<uint8_t> HuffmanTable(int table_class, int id, int length,
+                                  const std::vector<uint8_t>& symbols) {
+    int count = symbols.size();
+    std::vector<uint8_t> table(17);
+    table[0] = static_cast<uint8_t>(table_class << 4 | id);
+    table[length - 1] = static_cast<uint8_t>((1 << length) - 1 - count);
+    table[length] = static_cast<uint8_t>(2 * count + 1 - (1 << length));
+    table.insert(table.end(), symbols.begin(), symbols.end());
+    return table;
+}
+
+// Bytes left to PickOptions() after StructuredJpeg().
+constexpr size_t kOptionBytes = 16;
+
+// A baseline file whose headers are always well formed: the provider picks the size,
+// the components and their sampling factors and the quantizers, most of the rest is the
+// entropy-coded data. In it 0xFF followed by an odd byte becomes the next restart marker,
+// other 0xFF bytes are stuffed. Reaches the MCU loops without a seed corpus.
+std::vector<uint8_t> StructuredJpeg(FuzzedDataProvider& provider) {
+    auto height = provider.ConsumeIntegralInRange<uint16_t>(1, 256);
+    auto width = provider.ConsumeIntegralInRange<uint16_t>(1, 256);
+    auto components = provider.PickValueInArray({1, 3});
+
+    std::vector<uint8_t> out = {0xFF, 0xD8};
+
+    std::vector<uint8_t> dqt = {0};
+    for (int i = 0; i < 64; ++i) {
+        dqt.push_back(provider.ConsumeIntegral<uint8_t>());
+    }
+    PutSegment(out, 0xDB, dqt);
+
+    std::vector<uint8_t> sof = {8,
+                                static_cast<uint8_t>(height >> 8),
+                                static_cast<uint8_t>(height & 0xFF),
+                                static_cast<uint8_t>(width >> 8),
+                                static_cast<uint8_t>(width & 0xFF),
+                                static_cast<uint8_t>(components)};
+    for (int i = 0; i < components; ++i) {
+        // Mostly chroma subsampled by the luma factors, which stays within 10 blocks per MCU.
+        static constexpr uint8_t kLuma[] = {1, 2, 3, 4};
+        static constexpr uint8_t kChroma[] = {1, 1, 1, 2};
+        auto h = provider.PickValueInArray(i ? kChroma : kLuma);
+        auto v = provider.PickValueInArray(i ? kChroma : kLuma);
+        sof.insert(sof.end(), {static_cast<uint8_t>(i + 1), static_cast<uint8_t>(h << 4 | v), 0});
+    }
+    PutSegment(out, 0xC0, sof);
+
+    // Every DC size and every AC run/size, so any bit sequence decodes to symbols.
+    std::vector<uint8_t> dc_symbols(12);
+    for (size_t i = 0; i < dc_symbols.size(); ++i) {
+        dc_symbols[i] = static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> ac_symbols = {0x00, 0xF0};
+    for (int run = 0; run < 16; ++run) {
+        for (int size = 1; size <= 10; ++size) {
+            ac_symbols.push_back(static_cast<uint8_t>(run << 4 | size));
+        }
+    }
+    PutSegment(out, 0xC4, HuffmanTable(0, 0, 4, dc_symbols));
+    PutSegment(out, 0xC4, HuffmanTable(1, 0, 8, ac_symbols));
+
+    if (provider.ConsumeBool()) {
+        auto interval = provider.ConsumeIntegralInRange<uint16_t>(1, 64);
+        PutSegment(out, 0xDD, {static_cast<uint8_t>(interval >> 8),
+                               static_cast<uint8_t>(interval & 0xFF)});
+    }
+
+    std::vector<uint8_t> sos = {static_cast<uint8_t>(components)};
+    for (int i = 0; i < components; ++i) {
+        sos.insert(sos.end(), {static_cast<uint8_t>(i + 1), 0x00});
+    }
+    sos.insert(sos.end(), {0, 63, 0});
+    PutSegment(out, 0xDA, sos);
+
+    size_t remaining = provider.remaining_bytes();
+    auto scan = provider.ConsumeBytes<uint8_t>(remaining - std::min(remaining, kOptionBytes));
+    int restarts = 0;
+    for (size_t i = 0; i < scan.size(); ++i) {
+        out.push_back(scan[i]);
+        if (scan[i] != 0xFF) {
+            continue;
+        }
+        if (i + 1 < scan.size() && scan[i + 1] % 2) {
+            out.push_back(static_cast<uint8_t>(0xD0 + restarts++ % 8));
+            ++i;
+        } else {
+            out.push_back(0x00);
+        }
+    }
+    out.insert(out.end(), {0xFF, 0xD9});
+    return out;
+}
+
+DecodeOptions PickOptions(FuzzedDataProvider& provider, const JpegInfo& info) {
+    static ThreadPool pool(2);
+
+    DecodeOptions options;
+    options.limits.max_pixels = kMaxPixels;
+    options.limits.max_memory = kMaxMemory;
+    options.idct = provider.PickValueInArray({IdctBackend::kAuto, IdctBackend::kScalar});
+    options.scale = provider.PickValueInArray({1, 2, 4, 8});
+    options.upsampling = provider.ConsumeBool() ? Upsampling::kFancy : Upsampling::kNearest;
+    if (provider.ConsumeBool()) {
+        options.pool = &pool;
+    }
+    // Without a size from ProbeJpeg the decode fails anyway.
+    if (info.width && info.height && provider.ConsumeBool()) {
+        size_t width = (info.width - 1) / options.scale + 1;
+        size_t height = (info.height - 1) / options.scale + 1;
+        options.crop.x = provider.ConsumeIntegralInRange<size_t>(0, width - 1);
+        options.crop.y = provider.ConsumeIntegralInRange<size_t>(0, height - 1);
+        options.crop.width = provider.ConsumeIntegralInRange<size_t>(1, width - options.crop.x);
+        options.crop.height = provider.ConsumeIntegralInRange<size_t>(1, height - options.crop.y);
+    }
+    return options;
+}
+
+}  // namespace
+
+// An input starting with 0xFF is a file, decoded as is: that is what the mutations of a
+// seed corpus look like. The options are picked from its last bytes, which stay part of the
+// file. Anything else is the provider for StructuredJpeg() after the first byte.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    bool raw = data[0] == 0xFF;
+    FuzzedDataProvider provider(raw ? data : data + 1, raw ? size : size - 1);
+    std::vector<uint8_t> structured;
+    std::span<const uint8_t> file(data, size);
+    if (!raw) {
+        structured = StructuredJpeg(provider);
+        file = structured;
+    }
+
+    JpegInfo info;
+    try {
+        info = ProbeJpeg(file);
+    } catch (const std::invalid_argument&) {
+    }
+
+    DecodeOptions options = PickOptions(provider, info);
+    NullSink sink;
+    try {
+        switch (provider.ConsumeIntegralInRange(0, 2)) {
+            case 0:
+                Decode(file, options);
+                break;
+            case 1:
+                DecodeRows(file, sink, options);
+                break;
+            default: {
+                IncrementalDecoder decoder(sink, options);
+                size_t chunk = provider.ConsumeIntegralInRange<size_t>(1, 4096);
+                for (size_t pos = 0; pos < file.size(); pos += chunk) {
+                    decoder.Feed(file.subspan(pos, std::min(chunk, file.size() - pos)));
+                }
+                decoder.Finish();
+            }
+        }
+    } catch (const std::invalid_argument&) {
+        // Malformed input or beyond the limits, the only ways the decoder may fail.
+    }
+    return 0;
+}
+
+#if defined(DECODER_FUZZ_STANDALONE)
+// Without libFuzzer (e.g. built with GCC) the target replays a corpus instead: every file
+// given, directories recursively, in passes until -max_total_time=SECONDS is over (a single
+// pass without it) or -runs=N inputs ran. Reports the executions per second at the end.
+int main(int argc, char** argv) {
+    double max_total_time = 0;
+    size_t runs = 0;
+    std::vector<std::vector<uint8_t>> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("-max_total_time=", 0) == 0) {
+            max_total_time = std::stod(arg.substr(16));
+        } else if (arg.rfind("-runs=", 0) == 0) {
+            runs = std::stoul(arg.substr(6));
+        } else if (std::filesystem::is_directory(arg)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(arg)) {
+                if (entry.is_regular_file()) {
+                    std::ifstream input(entry.path(), std::ios::binary);
+                    inputs.emplace_back(std::istreambuf_iterator<char>(input),
+                                        std::istreambuf_iterator<char>());
+                }
+            }
+        } else {
+            std::ifstream input(arg, std::ios::binary);
+            if (!input) {
+                std::fprintf(stderr, "Cannot open %s\n", arg.c_str());
+                return 1;
+            }
+            inputs.emplace_back(std::istreambuf_iterator<char>(input),
+                                std::istreambuf_iterator<char>());
+        }
+    }
+    if (inputs.empty()) {
+        std::fprintf(stderr, "Usage: %s [-max_total_time=SECONDS] [-runs=N] FILE|DIR...\n",
+                     argv[0]);
+        return 1;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto elapsed = [&] { return std::chrono::duration<double>(Clock::now() - start).count(); };
+    size_t execs = 0;
+    auto more = [&] {
+        if (runs && execs >= runs) {
+            return false;
+        }
+        return elapsed() < max_total_time || (runs && max_total_time == 0);
+    };
+    do {
+        for (const auto& input : inputs) {
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+            if (++execs == runs) {
+                break;
+            }
+        }
+    } while (more());
+
+    double seconds = elapsed();
+    std::printf("Done %zu runs of %zu inputs in %.3f s, %.0f execs/sec\n", execs, inputs.size(),
+                seconds, seconds > 0 ? execs / seconds : 0.0);
+    return 0;
+}
+#endif
@@ -0,0 +1,50 @@
+#include <arena.h>
+
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena(size_t block_size) : block_size_(block_size) {
+}
+
+void Arena::Release() {
+    if (blocks_.size() > 1) {
+        size_t total = Capacity();
+        blocks_.clear();
+        AddBlock(total);
+    }
+    used_ = 0;
+    allocated_ = 0;
+}
+
+size_t Arena::Capacity() const {
+    size_t total = 0;
+    for (const auto& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+    if (!blocks_.empty()) {
+        auto& block = blocks_.back();
+        auto address = reinterpret_cast<uintptr_t>(block.data.get()) + used_;
+        size_t padding = (alignment - address % alignment) % alignment;
+        if (used_ + padding + bytes <= block.size) {
+            used_ += padding + bytes;
+            allocated_ += padding + bytes;
+            return block.data.get() + used_ - bytes;
+        }
+    }
+
+    // Blocks grow geometrically, so a decode needs few of them. operator new[] aligns to
+    // max_align_t, larger alignments get room to shift the start.
+    size_t last = blocks_.empty() ? 0 : blocks_.back().size;
+    size_t extra = alignment > alignof(std::max_align_t) ? alignment : 0;
+    AddBlock(std::max({block_size_, 2 * last, bytes + extra}));
+    return do_allocate(bytes, alignment);
+}
+
+void Arena::AddBlock(size_t size) {
+    blocks_.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+    used_ = 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Monotonic allocator for the state of one decode: allocations bump a pointer through large
+// blocks, deallocation does nothing and Release() frees everything at once. The blocks are
+// kept, so once an arena has seen a decode the next one of a similar image doesn't allocate.
+// Not thread safe.
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(size_t block_size = kDefaultBlockSize);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Invalidates everything allocated so far. The memory is kept for the next allocations,
+    // merged into one block if it was spread over several.
+    void Release();
+
+    // Bytes held in blocks, used or not.
+    size_t Capacity() const;
+
+    // Bytes handed out since the last Release(), alignment padding included.
+    size_t Used() const {
+        return allocated_;
+    }
+
+    static constexpr size_t kDefaultBlockSize = 16 << 10;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void*, size_t, size_t) override {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    void AddBlock(size_t size);
+
+    std::vector<Block> blocks_;
+    // Bytes used in blocks_.back().
+    size_t used_ = 0;
+    size_t allocated_ = 0;
+    size_t block_size_;
+};
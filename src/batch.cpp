@@ -0,0 +1,108 @@
+#include <batch.h>
+#include <jpeg_decoder.h>
+#include <mapped_file.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+std::vector<BatchJob> ReadManifest(std::istream& input) {
+    std::vector<BatchJob> jobs;
+    std::string line;
+    size_t number = 0;
+
+    while (std::getline(input, line)) {
+        ++number;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos || line[0] == '#') {
+            continue;
+        }
+
+        BatchJob job;
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos && line.find('\t', tab + 1) == std::string::npos) {
+            job.input = line.substr(0, tab);
+            job.output = line.substr(tab + 1);
+        } else {
+            std::istringstream words(line);
+            std::string extra;
+            words >> job.input >> job.output >> extra;
+            if (!extra.empty()) {
+                job.output.clear();
+            }
+        }
+
+        if (job.input.empty() || job.output.empty()) {
+            throw std::invalid_argument("Broken manifest line " + std::to_string(number));
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    return jobs;
+}
+
+namespace {
+
+void ConvertOne(const BatchJob& job, JpegDecoder& decoder, const PngOptions& png_options) {
+    MappedFile file(job.input);
+    PngWriter writer(job.output, png_options);
+    decoder.DecodeRows(file.Data(), writer);
+}
+
+}  // namespace
+
+size_t ConvertBatch(const std::vector<BatchJob>& jobs, size_t workers,
+                    const DecodeOptions& options, const PngOptions& png_options,
+                    std::ostream& log) {
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = std::max<size_t>(1, std::min(workers, jobs.size()));
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    std::mutex log_mutex;
+
+    // A ThreadPool runs one ParallelFor at a time and DecodeStats isn't synchronized, every
+    // worker gets its own pool from JpegDecoder instead.
+    DecodeOptions worker_options = options;
+    worker_options.pool = nullptr;
+    worker_options.stats = nullptr;
+
+    auto work = [&] {
+        JpegDecoder decoder(worker_options);
+
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            const auto& job = jobs[i];
+            try {
+                ConvertOne(job, decoder, png_options);
+                std::lock_guard<std::mutex> lock(log_mutex);
+                log << "OK " << job.input << " -> " << job.output << '\n';
+            } catch (std::exception& ex) {
+                ++failed;
+                std::lock_guard<std::mutex> lock(log_mutex);
+                log << "FAILED " << job.input << ": " << ex.what() << '\n';
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    log << "Converted " << jobs.size() - failed << " of " << jobs.size() << " images, "
+        << failed << " failed\n";
+    return failed;
+}
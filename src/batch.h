@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "png_encoder.hpp"
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// Parses a manifest with one "input<TAB>output" pair per line. Lines without a tab are split
+// on whitespace instead. Empty lines and lines starting with '#' are skipped. Throws
+// std::invalid_argument on lines that don't hold exactly one pair.
+std::vector<BatchJob> ReadManifest(std::istream& input);
+
+// Converts every job to PNG on |workers| threads (0 means one per hardware thread). Each
+// worker keeps its own JpegDecoder across the images it takes, options.pool and
+// options.stats are ignored since the workers would share them. A failed job doesn't stop
+// the others. One line per job and a summary are written to |log|. Returns the number of
+// failed jobs.
+size_t ConvertBatch(const std::vector<BatchJob>& jobs, size_t workers,
+                    const DecodeOptions& options = {}, const PngOptions& png_options = {},
+                    std::ostream& log = std::cerr);
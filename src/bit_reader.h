@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Reads the entropy-coded scan MSB first. The scan is kept exactly as it is stored in the
+// file, byte stuffing (0xFF 0x00) is removed while refilling the 64-bit bit buffer.
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : begin_(data), pos_(data), end_(data + size) {
+    }
+
+    explicit BitReader(const std::vector<uint8_t>& data) : BitReader(data.data(), data.size()) {
+    }
+
+    // Returns the next |count| <= 32 bits without consuming them. Bits past the end of the
+    // scan are read as zeros, so a lookahead near the end never fails by itself.
+    uint32_t Peek(int count) {
+        if (bits_ < count) {
+            Refill();
+        }
+        return count ? static_cast<uint32_t>(buffer_ >> (64 - count)) : 0;
+    }
+
+    void Skip(int count) {
+        if (bits_ < count) {
+            Refill();
+            if (bits_ < count) {
+                throw std::invalid_argument("Too short bit sequence");
+            }
+        }
+        buffer_ <<= count;
+        bits_ -= count;
+    }
+
+    uint32_t GetBits(int count) {
+        uint32_t res = Peek(count);
+        Skip(count);
+        return res;
+    }
+
+    bool GetBit() {
+        return GetBits(1);
+    }
+
+    // Continues on a relocated and possibly longer copy of the data, for scans that arrive
+    // in chunks. The data must not have ended at a marker before.
+    void Rebase(const uint8_t* data, size_t size) {
+        size_t offset = reinterpret_cast<uintptr_t>(pos_) - reinterpret_cast<uintptr_t>(begin_);
+        begin_ = data;
+        pos_ = data + offset;
+        end_ = data + size;
+    }
+
+private:
+    static bool HasFF(uint64_t word) {
+        uint64_t inv = ~word;
+        return (inv - 0x0101010101010101ULL) & ~inv & 0x8080808080808080ULL;
+    }
+
+    void Refill() {
+        // Word-sized refill when the next eight bytes carry no stuffing.
+        if (end_ - pos_ >= 8) {
+            uint64_t word;
+            std::memcpy(&word, pos_, sizeof(word));
+            word = __builtin_bswap64(word);
+            if (!HasFF(word)) {
+                int bytes = (64 - bits_) >> 3;
+                int rest = 64 - bits_ - 8 * bytes;
+                buffer_ |= (word >> bits_) & ~((uint64_t{1} << rest) - 1);
+                bits_ += 8 * bytes;
+                pos_ += bytes;
+                return;
+            }
+        }
+
+        while (bits_ <= 56 && pos_ != end_) {
+            uint8_t byte = *pos_++;
+            if (byte == 0xFF) {
+                if (pos_ != end_ && *pos_ == 0x00) {
+                    ++pos_;
+                } else {
+                    // A marker ends the entropy-coded data, everything after reads as zeros.
+                    --pos_;
+                    end_ = pos_;
+                    break;
+                }
+            }
+            buffer_ |= static_cast<uint64_t>(byte) << (56 - bits_);
+            bits_ += 8;
+        }
+    }
+
+    const uint8_t* begin_;
+    const uint8_t* pos_;
+    const uint8_t* end_;
+
+    // The top |bits_| bits of |buffer_| are the next bits of the scan, the rest are zeros.
+    uint64_t buffer_ = 0;
+    int bits_ = 0;
+};
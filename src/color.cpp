@@ -0,0 +1,220 @@
+#include <color.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int32_t kColorHalf = 1 << (kColorBits - 1);
+
+uint8_t Clamp(int value) {
+    return std::clamp(value, 0, 255);
+}
+
+void YCbCrToRgbScalar(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                      int chroma_shift, uint8_t* out) {
+    for (size_t x = 0; x < width; ++x) {
+        int luma = y[x];
+        int blue = cb[x >> chroma_shift] - 128;
+        int red = cr[x >> chroma_shift] - 128;
+        out[3 * x] = Clamp(luma + red + ((kCrToR * red + kColorHalf) >> kColorBits));
+        out[3 * x + 1] = Clamp(luma - red +
+                               ((kCbToG * blue + kCrToG * red + kColorHalf) >> kColorBits));
+        out[3 * x + 2] = Clamp(luma + 2 * blue + ((kCbToB * blue + kColorHalf) >> kColorBits));
+    }
+}
+
+#if defined(__SSE2__)
+// Factors for _mm_madd_epi16 over interleaved (Cb, Cr) word pairs.
+__m128i PairFactors(int32_t cb, int32_t cr) {
+    return _mm_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(cr) << 16) |
+                                               static_cast<uint16_t>(cb)));
+}
+
+// Fixed-point part of one output channel for eight pixels.
+__m128i Scaled(__m128i lo_pairs, __m128i hi_pairs, __m128i factors) {
+    const __m128i half = _mm_set1_epi32(kColorHalf);
+    __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo_pairs, factors), half),
+                                kColorBits);
+    __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi_pairs, factors), half),
+                                kColorBits);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// Eight pixels in 16-bit lanes, Cb and Cr already centered at 0.
+void ConvertSse2(__m128i y, __m128i cb, __m128i cr, __m128i* r, __m128i* g, __m128i* b) {
+    __m128i lo = _mm_unpacklo_epi16(cb, cr);
+    __m128i hi = _mm_unpackhi_epi16(cb, cr);
+    *r = _mm_add_epi16(_mm_add_epi16(y, cr), Scaled(lo, hi, PairFactors(0, kCrToR)));
+    *g = _mm_add_epi16(_mm_sub_epi16(y, cr), Scaled(lo, hi, PairFactors(kCbToG, kCrToG)));
+    *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)),
+                       Scaled(lo, hi, PairFactors(kCbToB, 0)));
+}
+
+// 16 chroma samples for 16 pixels.
+__m128i LoadChromaSse2(const uint8_t* chroma, int chroma_shift) {
+    if (chroma_shift) {
+        __m128i half = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(chroma));
+        return _mm_unpacklo_epi8(half, half);
+    }
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(chroma));
+}
+
+}  // namespace
+
+size_t YCbCrToRgbSse2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                      int chroma_shift, uint8_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+
+    size_t x = 0;
+    // Pixels are stored as 4 bytes (R, G, B, 0), the last one of a block overlaps the first
+    // byte of the next pixel, so a block is only converted if more pixels follow.
+    for (; x + 16 < width; x += 16) {
+        __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i blue = LoadChromaSse2(cb + (x >> chroma_shift), chroma_shift);
+        __m128i red = LoadChromaSse2(cr + (x >> chroma_shift), chroma_shift);
+
+        __m128i r[2], g[2], b[2];
+        ConvertSse2(_mm_unpacklo_epi8(luma, zero),
+                    _mm_sub_epi16(_mm_unpacklo_epi8(blue, zero), bias),
+                    _mm_sub_epi16(_mm_unpacklo_epi8(red, zero), bias), &r[0], &g[0], &b[0]);
+        ConvertSse2(_mm_unpackhi_epi8(luma, zero),
+                    _mm_sub_epi16(_mm_unpackhi_epi8(blue, zero), bias),
+                    _mm_sub_epi16(_mm_unpackhi_epi8(red, zero), bias), &r[1], &g[1], &b[1]);
+
+        __m128i rs = _mm_packus_epi16(r[0], r[1]);
+        __m128i gs = _mm_packus_epi16(g[0], g[1]);
+        __m128i bs = _mm_packus_epi16(b[0], b[1]);
+        __m128i rg_lo = _mm_unpacklo_epi8(rs, gs);
+        __m128i rg_hi = _mm_unpackhi_epi8(rs, gs);
+        __m128i b_lo = _mm_unpacklo_epi8(bs, zero);
+        __m128i b_hi = _mm_unpackhi_epi8(bs, zero);
+
+        alignas(16) uint32_t pixels[16];
+        __m128i* words = reinterpret_cast<__m128i*>(pixels);
+        _mm_store_si128(words, _mm_unpacklo_epi16(rg_lo, b_lo));
+        _mm_store_si128(words + 1, _mm_unpackhi_epi16(rg_lo, b_lo));
+        _mm_store_si128(words + 2, _mm_unpacklo_epi16(rg_hi, b_hi));
+        _mm_store_si128(words + 3, _mm_unpackhi_epi16(rg_hi, b_hi));
+        for (size_t i = 0; i < 16; ++i) {
+            std::memcpy(out + 3 * (x + i), &pixels[i], sizeof(pixels[i]));
+        }
+    }
+    return x;
+}
+
+namespace {
+
+// Eight samples widened to 16 bits.
+__m128i Widen(const uint8_t* data) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(data)),
+                             _mm_setzero_si128());
+}
+
+__m128i Triple(__m128i value) {
+    return _mm_add_epi16(_mm_add_epi16(value, value), value);
+}
+
+// Interleaves eight even and eight odd output samples into 16 bytes of |out|.
+void StorePairs(__m128i even, __m128i odd, uint8_t* out) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     _mm_packus_epi16(_mm_unpacklo_epi16(even, odd),
+                                      _mm_unpackhi_epi16(even, odd)));
+}
+
+size_t FancyH2V1Sse2(const uint8_t* near, size_t count, uint8_t* out) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i three = Triple(Widen(near + i));
+        __m128i even = _mm_add_epi16(_mm_add_epi16(three, Widen(near + i - 1)),
+                                     _mm_set1_epi16(1));
+        __m128i odd = _mm_add_epi16(_mm_add_epi16(three, Widen(near + i + 1)),
+                                    _mm_set1_epi16(2));
+        StorePairs(_mm_srli_epi16(even, 2), _mm_srli_epi16(odd, 2), out + 2 * i);
+    }
+    return i;
+}
+
+size_t FancyH2V2Sse2(const uint8_t* near, const uint8_t* far, size_t count, uint8_t* out) {
+    auto column_sums = [&](size_t i) {
+        return _mm_add_epi16(Triple(Widen(near + i)), Widen(far + i));
+    };
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i three = Triple(column_sums(i));
+        __m128i even = _mm_add_epi16(_mm_add_epi16(three, column_sums(i - 1)),
+                                     _mm_set1_epi16(8));
+        __m128i odd = _mm_add_epi16(_mm_add_epi16(three, column_sums(i + 1)),
+                                    _mm_set1_epi16(7));
+        StorePairs(_mm_srli_epi16(even, 4), _mm_srli_epi16(odd, 4), out + 2 * i);
+    }
+    return i;
+}
+#endif
+
+bool HaveAvx2() {
+#if defined(JPEG_DECODER_HAVE_AVX2)
+    static const bool kSupported = __builtin_cpu_supports("avx2");
+    return kSupported;
+#else
+    return false;
+#endif
+}
+
+}  // namespace
+
+void YCbCrToRgbRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                   int chroma_shift, uint8_t* out) {
+    size_t done = 0;
+#if defined(JPEG_DECODER_HAVE_AVX2)
+    if (HaveAvx2()) {
+        done = YCbCrToRgbAvx2(y, cb, cr, width, chroma_shift, out);
+    }
+#endif
+#if defined(__SSE2__)
+    if (!HaveAvx2()) {
+        done = YCbCrToRgbSse2(y, cb, cr, width, chroma_shift, out);
+    }
+#endif
+    // |done| is a multiple of 16, so the chroma phase is unchanged.
+    YCbCrToRgbScalar(y + done, cb + (done >> chroma_shift), cr + (done >> chroma_shift),
+                     width - done, chroma_shift, out + 3 * done);
+}
+
+void FancyUpsampleH2V1(const uint8_t* near, size_t count, uint8_t* out) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    i = FancyH2V1Sse2(near, count, out);
+#endif
+    for (; i < count; ++i) {
+        int three = 3 * near[i];
+        out[2 * i] = (three + near[i - 1] + 1) >> 2;
+        out[2 * i + 1] = (three + near[i + 1] + 2) >> 2;
+    }
+}
+
+void FancyUpsampleH2V2(const uint8_t* near, const uint8_t* far, size_t count, uint8_t* out) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    i = FancyH2V2Sse2(near, far, count, out);
+#endif
+    auto column_sum = [&](size_t i) { return 3 * near[i] + far[i]; };
+    for (; i < count; ++i) {
+        int three = 3 * column_sum(i);
+        out[2 * i] = (three + column_sum(i - 1) + 8) >> 4;
+        out[2 * i + 1] = (three + column_sum(i + 1) + 7) >> 4;
+    }
+}
+
+void FancyUpsampleH1V2(const uint8_t* near, const uint8_t* far, size_t count, bool lower,
+                       uint8_t* out) {
+    int bias = lower ? 2 : 1;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = (3 * near[i] + far[i] + bias) >> 2;
+    }
+}
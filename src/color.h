@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// libjpeg's 16-bit fixed-point YCbCr -> RGB factors, split so that each fits a signed 16-bit
+// lane: 1.402 = 1 + 0.402, 0.71414 = 1 - 0.28586 and 1.772 = 2 - 0.228. With Cb and Cr
+// centered at 0:
+//   R = Y + Cr + (kCrToR * Cr + half) >> 16
+//   G = Y - Cr + (kCbToG * Cb + kCrToG * Cr + half) >> 16
+//   B = Y + 2 * Cb + (kCbToB * Cb + half) >> 16
+// which is bit-exact with libjpeg's jdcolor.
+constexpr int kColorBits = 16;
+constexpr int32_t kCrToR = 26345;
+constexpr int32_t kCbToG = -22554;
+constexpr int32_t kCrToG = 18734;
+constexpr int32_t kCbToB = -14942;
+
+// Converts |width| pixels to RGB24 in |out|. Pixel x takes y[x] and the chroma samples at
+// x >> |chroma_shift|: 0 for full-resolution chroma, 1 for chroma shared by two columns
+// (4:2:2 and 4:2:0), which is upsampled on the fly. Uses the widest vector unit the CPU has.
+void YCbCrToRgbRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                   int chroma_shift, uint8_t* out);
+
+// Fancy (triangle filter) chroma upsampling as in libjpeg: every output sample is 3/4 of the
+// nearest chroma sample and 1/4 of the next nearest one, with libjpeg's rounding so the
+// results are bit-exact with it.
+//
+// The H2 kernels double |count| samples of |near| into 2 * |count| samples of |out|. They
+// read near[-1] and near[count] (and the same around |far|), which the caller sets to the
+// edge sample at the image border.
+void FancyUpsampleH2V1(const uint8_t* near, size_t count, uint8_t* out);
+
+// Also blends vertically with |far|, the chroma row above for the upper of the two output
+// rows and the one below for the lower one.
+void FancyUpsampleH2V2(const uint8_t* near, const uint8_t* far, size_t count, uint8_t* out);
+
+// Vertical only, |count| samples.
+void FancyUpsampleH1V2(const uint8_t* near, const uint8_t* far, size_t count, bool lower,
+                       uint8_t* out);
+
+// The vector parts of YCbCrToRgbRow, which picks one by CPU and finishes the row with scalar
+// code. Tests call each of them directly.
+#if defined(__SSE2__)
+// Converts blocks of 16 pixels while more pixels follow (its stores spill into the next
+// pixel) and returns how many pixels that were.
+size_t YCbCrToRgbSse2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                      int chroma_shift, uint8_t* out);
+#endif
+
+#if defined(JPEG_DECODER_HAVE_AVX2)
+// Converts the first multiple of 32 pixels of the row and returns how many that were.
+size_t YCbCrToRgbAvx2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                      int chroma_shift, uint8_t* out);
+#endif
@@ -0,0 +1,114 @@
+// Built with -mavx2, only called after a runtime CPU check.
+
+#include <color.h>
+
+#include <immintrin.h>
+
+namespace {
+
+__m256i PairFactors(int32_t cb, int32_t cr) {
+    return _mm256_set1_epi32(static_cast<int32_t>((static_cast<uint32_t>(cr) << 16) |
+                                                  static_cast<uint16_t>(cb)));
+}
+
+__m256i Scaled(__m256i lo_pairs, __m256i hi_pairs, __m256i factors) {
+    const __m256i half = _mm256_set1_epi32(1 << (kColorBits - 1));
+    __m256i lo = _mm256_srai_epi32(
+        _mm256_add_epi32(_mm256_madd_epi16(lo_pairs, factors), half), kColorBits);
+    __m256i hi = _mm256_srai_epi32(
+        _mm256_add_epi32(_mm256_madd_epi16(hi_pairs, factors), half), kColorBits);
+    // Unpacking and packing within the 128-bit lanes keeps the pixel order.
+    return _mm256_packs_epi32(lo, hi);
+}
+
+// 16 pixels in 16-bit lanes, Cb and Cr already centered at 0.
+void Convert(__m256i y, __m256i cb, __m256i cr, __m256i* r, __m256i* g, __m256i* b) {
+    __m256i lo = _mm256_unpacklo_epi16(cb, cr);
+    __m256i hi = _mm256_unpackhi_epi16(cb, cr);
+    *r = _mm256_add_epi16(_mm256_add_epi16(y, cr), Scaled(lo, hi, PairFactors(0, kCrToR)));
+    *g = _mm256_add_epi16(_mm256_sub_epi16(y, cr),
+                          Scaled(lo, hi, PairFactors(kCbToG, kCrToG)));
+    *b = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_add_epi16(cb, cb)),
+                          Scaled(lo, hi, PairFactors(kCbToB, 0)));
+}
+
+// Centered chroma of 32 pixels as two vectors of 16 words.
+void LoadChroma(const uint8_t* chroma, int chroma_shift, __m256i* first, __m256i* second) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    if (chroma_shift) {
+        __m256i words =
+            _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(chroma)));
+        // Samples 0-3 and 8-11 in the low lane, 4-7 and 12-15 in the high one, so that
+        // duplicating within the lanes gives pixels 0-15 and 16-31 in order.
+        words = _mm256_permute4x64_epi64(words, 0xD8);
+        *first = _mm256_sub_epi16(_mm256_unpacklo_epi16(words, words), bias);
+        *second = _mm256_sub_epi16(_mm256_unpackhi_epi16(words, words), bias);
+    } else {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chroma));
+        *first = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)), bias);
+        *second = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)),
+                                   bias);
+    }
+}
+
+// Shuffle controls taking one channel of 16 pixels into each 16-byte part of their RGB24
+// layout, -128 zeroes the bytes of the other channels.
+struct InterleaveMasks {
+    InterleaveMasks() {
+        for (int part = 0; part < 3; ++part) {
+            for (int channel = 0; channel < 3; ++channel) {
+                alignas(16) int8_t control[16];
+                for (int i = 0; i < 16; ++i) {
+                    int byte = 16 * part + i;
+                    control[i] = byte % 3 == channel ? byte / 3 : -128;
+                }
+                masks[part][channel] = _mm_load_si128(reinterpret_cast<__m128i*>(control));
+            }
+        }
+    }
+
+    __m128i masks[3][3];
+};
+
+void StoreRgb(__m128i r, __m128i g, __m128i b, const InterleaveMasks& interleave,
+              uint8_t* out) {
+    for (int part = 0; part < 3; ++part) {
+        const __m128i* masks = interleave.masks[part];
+        __m128i bytes = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(r, masks[0]), _mm_shuffle_epi8(g, masks[1])),
+            _mm_shuffle_epi8(b, masks[2]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * part), bytes);
+    }
+}
+
+}  // namespace
+
+size_t YCbCrToRgbAvx2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                      int chroma_shift, uint8_t* out) {
+    static const InterleaveMasks kInterleave;
+
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i luma = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+        __m256i y0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(luma));
+        __m256i y1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(luma, 1));
+        __m256i cb0, cb1, cr0, cr1;
+        LoadChroma(cb + (x >> chroma_shift), chroma_shift, &cb0, &cb1);
+        LoadChroma(cr + (x >> chroma_shift), chroma_shift, &cr0, &cr1);
+
+        __m256i r0, g0, b0, r1, g1, b1;
+        Convert(y0, cb0, cr0, &r0, &g0, &b0);
+        Convert(y1, cb1, cr1, &r1, &g1, &b1);
+
+        // Packing interleaves the 128-bit lanes of both halves, the permute undoes that.
+        __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xD8);
+        __m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xD8);
+        __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b0, b1), 0xD8);
+
+        StoreRgb(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+                 _mm256_castsi256_si128(b), kInterleave, out + 3 * x);
+        StoreRgb(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                 _mm256_extracti128_si256(b, 1), kInterleave, out + 3 * x + 48);
+    }
+    return x;
+}
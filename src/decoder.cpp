@@ -1,295 +1,1720 @@
-#define GOOGLE_STRIP_LOG 1
-
 #include <decoder.h>
-#include <map>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <vector>
 #include <string>
 #include <type_traits>
 #include <iostream>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 
+#include "arena.h"
 #include "jpeg.h"
 #include "input.h"
 #include "reader.h"
 #include "huffman.h"
-#include "fft.h"
+#include "idct.h"
+#include "bit_reader.h"
+#include "thread_pool.h"
+#include "color.h"
+
+// Work counts of the entropy decoder and the reconstruction for DecodeStats. Kept per
+// restart interval and per MCU row, so threads never share one. Only touched when
+// kDecodeStatsEnabled.
+struct BlockCounters {
+    size_t mcus = 0;
+    size_t blocks = 0;
+    size_t symbols = 0;
+    size_t eob_blocks = 0;
+    size_t dc_only_blocks = 0;
+
+    void AddTo(DecodeStats& stats) const {
+        stats.mcus += mcus;
+        stats.blocks += blocks;
+        stats.huffman_symbols += symbols;
+        stats.eob_blocks += eob_blocks;
+        stats.dc_only_blocks += dc_only_blocks;
+    }
+};
+
+// Adds the wall time until Stop() or the end of the scope to |*seconds|. Does nothing for
+// null, so stages are only timed when stats were asked for.
+class StageTimer {
+public:
+    explicit StageTimer(double* seconds) : seconds_(kDecodeStatsEnabled ? seconds : nullptr) {
+        if (seconds_) {
+            start_ = Clock::now();
+        }
+    }
+
+    ~StageTimer() {
+        Stop();
+    }
+
+    void Stop() {
+        if (seconds_) {
+            *seconds_ += std::chrono::duration<double>(Clock::now() - start_).count();
+            seconds_ = nullptr;
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double* seconds_;
+    Clock::time_point start_;
+};
+
+// Everything about one component that the MCU loops need.
+struct Component {
+    size_t h;
+    size_t v;
+    const HuffmanTree* dc_tree;
+    const HuffmanTree* ac_tree;
+    // Natural order, see QuantTable.
+    const std::array<int32_t, kMatrixSquare>* quant;
+    // Blocks in one row of blocks across the whole MCU row.
+    size_t blocks_x;
+    // Samples per block side: frame.block, or up to twice as many per halving of the
+    // upsampling factors for a subsampled component of a scaled decode, see GetFrame.
+    int block;
+    // Samples of the (scaled) image, the planes hold padding beyond them.
+    int width;
+    int high;
+    // Upsampling factors, max_h / h and max_v / v divided by block / frame.block.
+    int up_h;
+    int up_v;
+    // Fancy upsampled: 2x horizontally, vertically or both.
+    bool fancy = false;
+};
+
+struct Frame {
+    // The components are allocated from |memory|, the arena of the decode.
+    explicit Frame(std::pmr::memory_resource* memory) : components(memory) {
+    }
+
+    int width;
+    int high;
+    int max_h = 1;
+    int max_v = 1;
+    // MCUs per row and per column.
+    int len_h;
+    int len_v;
+    // Samples per block side after scaling: 8, 4, 2 or 1.
+    int block = kMatrixSide;
+    // Output size: the crop, or the image size divided by the scale and rounded up.
+    int out_width;
+    int out_high;
+    // Top left corner of the output in the scaled image.
+    int crop_x = 0;
+    int crop_y = 0;
+    // MCUs that intersect the output: columns [first_mcu_x, first_mcu_x + mcus_x) and rows
+    // [first_mcu_y, end_mcu_y). Only these are dequantized and reconstructed.
+    int first_mcu_x = 0;
+    int mcus_x;
+    int first_mcu_y = 0;
+    int end_mcu_y;
+    std::pmr::vector<Component> components;
+    // Fancy vertical upsampling blends chroma across MCU rows, see McuRow::above.
+    bool context_rows = false;
+};
+
+// Entropy-decodes one block and stores its dequantized coefficients in natural order.
+// Returns the zigzag index of the last nonzero coefficient, 0 for a DC-only block.
+int GetMatrix(const Component& comp, BitReader& reader, int& prev_dc, int32_t* coeffs,
+              BlockCounters& counters) {
+    const auto& quant_table = *comp.quant;
+    std::fill_n(coeffs, kMatrixSquare, 0);
+
+    int coeff;
+    if (comp.dc_tree->DecodeCoeff(reader, coeff) >> 4) {
+        throw std::invalid_argument("Broken DC coefficient length");
+    }
+    prev_dc += coeff;
+    coeffs[0] = prev_dc * quant_table[0];
+
+    int last = 0;
+    size_t index = 1;
+    size_t symbols = 1;
+    while (index < kMatrixSquare) {
+        int value = comp.ac_tree->DecodeCoeff(reader, coeff);
+        int zeros = (value >> 4) & 15;
+        int len = value & 15;
+        ++symbols;
 
-bool GetBit(const std::vector<bool>& data, size_t& ind) {
-    if (ind >= data.size()) {
-        throw std::invalid_argument("Too short bit sequence");
+        if (len == 0 && zeros == 0) {
+            break;
+        }
+
+        index += zeros;
+        if (index >= kMatrixSquare) {
+            throw std::invalid_argument("Matrix has invalid size");
+        }
+        // A run of 16 zeros (ZRL) "stores" a zero.
+        if (len) {
+            size_t pos = kZigzagToNatural[index];
+            coeffs[pos] = coeff * quant_table[pos];
+            last = index;
+        }
+        ++index;
     }
-    return data[ind++];
+
+    if constexpr (kDecodeStatsEnabled) {
+        ++counters.blocks;
+        counters.symbols += symbols;
+        counters.eob_blocks += index < kMatrixSquare;
+    }
+    return last;
 }
 
-int GetCoeff(const std::vector<bool>& data, size_t& ind, int len) {
-    if (len == 0) {
-        return 0;
+Upsampling ParseUpsampling(const std::string& name) {
+    if (name == "nearest") {
+        return Upsampling::kNearest;
+    } else if (name == "fancy") {
+        return Upsampling::kFancy;
     }
+    throw std::invalid_argument("Unknown upsampling: " + name);
+}
 
-    int res = 0;
-    for (int i = 0; i < len; ++i) {
-        res = 2 * res + GetBit(data, ind);
+std::string DecodeStatsToJson(const DecodeStats& stats) {
+    char buffer[512];
+    std::snprintf(buffer, sizeof(buffer),
+                  "{\"parse_seconds\": %.6f, \"entropy_seconds\": %.6f, \"idct_seconds\": %.6f, "
+                  "\"color_seconds\": %.6f, \"output_seconds\": %.6f, \"total_seconds\": %.6f, "
+                  "\"bytes_scanned\": %zu, \"mcus\": %zu, \"blocks\": %zu, "
+                  "\"huffman_symbols\": %zu, \"eob_blocks\": %zu, \"dc_only_blocks\": %zu, "
+                  "\"peak_arena_bytes\": %zu}",
+                  stats.parse_seconds, stats.entropy_seconds, stats.idct_seconds,
+                  stats.color_seconds, stats.output_seconds, stats.total_seconds,
+                  stats.bytes_scanned, stats.mcus, stats.blocks, stats.huffman_symbols,
+                  stats.eob_blocks, stats.dc_only_blocks, stats.peak_arena_bytes);
+    return buffer;
+}
+
+Frame GetFrame(const Jpeg& jpeg, size_t scale, const Crop& crop, Upsampling upsampling,
+               std::pmr::memory_resource* memory) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        throw std::invalid_argument("Unsupported scale");
     }
-    if (((res >> (len - 1)) & 1) == 0) {
-        res -= (1 << len) - 1;
+
+    Frame frame(memory);
+    frame.width = jpeg.info_.width_;
+    frame.high = jpeg.info_.high_;
+    frame.block = kMatrixSide / scale;
+    frame.out_width = (frame.width - 1) / scale + 1;
+    frame.out_high = (frame.high - 1) / scale + 1;
+
+    size_t channels = jpeg.sos_.channels_.size();
+    if (channels != 1 && channels != 3) {
+        throw std::invalid_argument("Invalid channel amount");
     }
+    frame.components.reserve(channels);
 
-    return res;
+    // Progressive scans pick their tables one scan at a time.
+    bool progressive = jpeg.info_.marker_ == 0xC2;
+
+    for (size_t i = 0; i < channels; ++i) {
+        auto chan = jpeg.sos_.channels_[i];
+        if (!progressive && (chan.table_id[0] >= jpeg.huff_tables_.data_[0].size() ||
+                             !jpeg.huff_tables_.data_[0][chan.table_id[0]].defined_)) {
+            throw std::invalid_argument("Invalid DC channel id");
+        }
+        if (!progressive && (chan.table_id[1] >= jpeg.huff_tables_.data_[1].size() ||
+                             !jpeg.huff_tables_.data_[1][chan.table_id[1]].defined_)) {
+            throw std::invalid_argument("Invalid AC channel id");
+        }
+        if (chan.quant_identifier_ >= jpeg.tables_.tables_.size()) {
+            throw std::invalid_argument("Invalid channel Quant table id");
+        }
+        if (chan.h < 1 || chan.h > 4 || chan.v < 1 || chan.v > 4) {
+            throw std::invalid_argument("Invalid channel compression");
+        }
+        // A lone component is never subsampled and its scans have one block per MCU,
+        // whatever its factors say.
+        if (channels == 1) {
+            chan.h = chan.v = 1;
+        }
+
+        frame.max_h = std::max(frame.max_h, static_cast<int>(chan.h));
+        frame.max_v = std::max(frame.max_v, static_cast<int>(chan.v));
+
+        Component comp;
+        comp.h = chan.h;
+        comp.v = chan.v;
+        comp.dc_tree = progressive ? nullptr : &jpeg.huff_tables_.data_[0][chan.table_id[0]].tree_;
+        comp.ac_tree = progressive ? nullptr : &jpeg.huff_tables_.data_[1][chan.table_id[1]].tree_;
+        comp.quant = &jpeg.tables_.tables_[chan.quant_identifier_].data_;
+        frame.components.push_back(comp);
+    }
+
+    size_t mcu_blocks = 0;
+    for (auto& comp : frame.components) {
+        mcu_blocks += comp.h * comp.v;
+        // Like libjpeg: e.g. Y 3x1 with Cb 2x1 would need Cb upsampled by 3/2.
+        if (frame.max_h % comp.h || frame.max_v % comp.v) {
+            throw std::invalid_argument("Fractional sampling factors");
+        }
+        comp.up_h = frame.max_h / comp.h;
+        comp.up_v = frame.max_v / comp.v;
+        // Like libjpeg, a scaled decode reconstructs subsampled components with a larger IDCT
+        // instead of upsampling them, e.g. 4:2:0 chroma at 1/2 scale with 8x8 blocks.
+        comp.block = frame.block;
+        while (comp.block < static_cast<int>(kMatrixSide) && comp.up_h % 2 == 0 &&
+               comp.up_v % 2 == 0) {
+            comp.block *= 2;
+            comp.up_h /= 2;
+            comp.up_v /= 2;
+        }
+        comp.width = (static_cast<size_t>(frame.width) * comp.h * comp.block - 1) /
+                         (frame.max_h * kMatrixSide) + 1;
+        comp.high = (static_cast<size_t>(frame.high) * comp.v * comp.block - 1) /
+                        (frame.max_v * kMatrixSide) + 1;
+        // Like libjpeg: only exact 2x factors, not for the single sample of 1/8 scale and
+        // not horizontally for chroma of one or two samples per row.
+        comp.fancy = upsampling == Upsampling::kFancy && frame.block > 1 && comp.up_h <= 2 &&
+                     comp.up_v <= 2 && comp.up_h * comp.up_v > 1 &&
+                     (comp.up_h == 1 || comp.width > 2);
+        frame.context_rows |= comp.fancy && comp.up_v == 2;
+    }
+    if (mcu_blocks > 10) {
+        throw std::invalid_argument("Too many blocks in MCU");
+    }
+
+    frame.len_v = (frame.high - 1) / (kMatrixSide * frame.max_v) + 1;
+    frame.len_h = (frame.width - 1) / (kMatrixSide * frame.max_h) + 1;
+
+    frame.mcus_x = frame.len_h;
+    frame.end_mcu_y = frame.len_v;
+    if (crop.width || crop.height) {
+        if (!crop.width || !crop.height || crop.x + crop.width > size_t(frame.out_width) ||
+            crop.y + crop.height > size_t(frame.out_high)) {
+            throw std::invalid_argument("Crop is outside the image");
+        }
+
+        int mcu_width = frame.max_h * frame.block;
+        int mcu_high = frame.max_v * frame.block;
+        frame.crop_x = crop.x;
+        frame.crop_y = crop.y;
+        frame.out_width = crop.width;
+        frame.out_high = crop.height;
+        frame.first_mcu_x = frame.crop_x / mcu_width;
+        frame.mcus_x = (frame.crop_x + frame.out_width - 1) / mcu_width - frame.first_mcu_x + 1;
+        frame.first_mcu_y = frame.crop_y / mcu_high;
+        frame.end_mcu_y = (frame.crop_y + frame.out_high - 1) / mcu_high + 1;
+
+        // Fancy upsampling at the border of the crop needs the chroma next to it, so one
+        // more MCU is decoded on every side.
+        bool fancy = std::any_of(frame.components.begin(), frame.components.end(),
+                                 [](const Component& comp) { return comp.fancy; });
+        if (fancy) {
+            int first_x = std::max(frame.first_mcu_x - 1, 0);
+            int end_x = std::min(frame.first_mcu_x + frame.mcus_x + 1, frame.len_h);
+            frame.first_mcu_x = first_x;
+            frame.mcus_x = end_x - first_x;
+            frame.first_mcu_y = std::max(frame.first_mcu_y - 1, 0);
+            frame.end_mcu_y = std::min(frame.end_mcu_y + 1, frame.len_v);
+        }
+    }
+
+    for (auto& comp : frame.components) {
+        comp.blocks_x = frame.mcus_x * comp.h;
+    }
+
+    return frame;
 }
 
-std::vector<int> Reorder(const std::vector<int>& data) {
-    size_t ind = 0;
-    std::vector<int> res(kMatrixSquare);
+// One MCU row, cut to the MCU columns of the output: the coefficients and the reconstructed
+// samples of every component. Only this much of the image is held in memory at a time.
+struct McuRow {
+    // Sizes the buffers for |frame|, keeping whatever capacity they already have.
+    void Resize(const Frame& frame) {
+        size_t channels = frame.components.size();
+        coeffs.resize(channels);
+        last.resize(channels);
+        samples.resize(channels);
+        for (size_t i = 0; i < channels; ++i) {
+            const auto& comp = frame.components[i];
+            coeffs[i].resize(comp.blocks_x * comp.v * kMatrixSquare);
+            last[i].resize(comp.blocks_x * comp.v);
+            samples[i].resize(comp.blocks_x * comp.v * comp.block * comp.block);
+        }
+        pixels.resize(frame.max_v * frame.block * frame.out_width * channels);
+        // Per component: the upsampled row and padded copies of the chroma rows it is
+        // made from, see ChromaRow. One more for a row ConvertMcuRow expands.
+        chroma.resize((channels + 1) * (2 * frame.out_width + 16));
 
-    for (int sum = 0; sum < 2 * kMatrixSide - 1; ++sum) {
-        if (sum % 2) {
-            for (int x = 0; x < kMatrixSide; ++x) {
-                int y = sum - x;
-                if (y < 0 || y >= kMatrixSide) {
-                    continue;
-                }
-                res[kMatrixSide * x + y] = data[ind++];
+        above.resize(channels);
+        below.resize(channels);
+        if (frame.context_rows) {
+            for (size_t i = 0; i < channels; ++i) {
+                const auto& comp = frame.components[i];
+                above[i].resize(comp.blocks_x * comp.block);
+                below[i].resize(comp.blocks_x * comp.block);
             }
-        } else {
-            for (int x = kMatrixSide - 1; x >= 0; --x) {
-                int y = sum - x;
-                if (y < 0 || y >= kMatrixSide) {
-                    continue;
-                }
-                res[kMatrixSide * x + y] = data[ind++];
+        }
+    }
+
+    // What Resize() allocates for |frame|, for DecodeLimits::max_memory.
+    static size_t Bytes(const Frame& frame) {
+        size_t channels = frame.components.size();
+        size_t bytes = frame.max_v * frame.block * frame.out_width * channels +
+                       (channels + 1) * (2 * frame.out_width + 16);
+        for (const auto& comp : frame.components) {
+            size_t blocks = comp.blocks_x * comp.v;
+            bytes += blocks * (kMatrixSquare * sizeof(int32_t) + 1 + comp.block * comp.block);
+            if (frame.context_rows) {
+                bytes += 2 * comp.blocks_x * comp.block;
             }
         }
+        return bytes;
     }
 
-    return res;
+    // Blocks of a component in raster order, comp.blocks_x per row of blocks.
+    std::vector<std::vector<int32_t>> coeffs;
+    // Zigzag index of the last nonzero coefficient of every block, for Idct's shortcuts.
+    std::vector<std::vector<uint8_t>> last;
+    // Component planes, comp.blocks_x * comp.block bytes per row.
+    std::vector<std::vector<uint8_t>> samples;
+    // Converted output rows, out_width * channels bytes each.
+    std::vector<uint8_t> pixels;
+    // Upsampled components of one output row, chroma and luma sampled lower than chroma.
+    std::vector<uint8_t> chroma;
+    // With frame.context_rows: the last sample row of every component in the MCU row above
+    // and the first one in the MCU row below.
+    std::vector<std::vector<uint8_t>> above;
+    std::vector<std::vector<uint8_t>> below;
+    // For DecodeStats, taken over when the row is emitted.
+    BlockCounters counters;
+    double idct_seconds = 0;
+    double color_seconds = 0;
+};
+
+// MCU rows per thread in a band, more than one evens out rows of different cost.
+constexpr size_t kRowsPerThread = 2;
+
+// Walks over one block without storing it, only the DC prediction is kept up to date.
+void SkipMatrix(const Component& comp, BitReader& reader, int& prev_dc,
+                BlockCounters& counters) {
+    int coeff;
+    if (comp.dc_tree->DecodeCoeff(reader, coeff) >> 4) {
+        throw std::invalid_argument("Broken DC coefficient length");
+    }
+    prev_dc += coeff;
+
+    size_t index = 1;
+    size_t symbols = 1;
+    while (index < kMatrixSquare) {
+        int value = comp.ac_tree->Decode(reader);
+        int zeros = (value >> 4) & 15;
+        int len = value & 15;
+        ++symbols;
+
+        if (len == 0 && zeros == 0) {
+            break;
+        }
+
+        reader.Skip(len);
+        index += zeros + 1;
+    }
+
+    if (index > kMatrixSquare) {
+        throw std::invalid_argument("Matrix has invalid size");
+    }
+    if constexpr (kDecodeStatsEnabled) {
+        ++counters.blocks;
+        counters.symbols += symbols;
+        counters.eob_blocks += index < kMatrixSquare;
+    }
 }
 
-std::vector<int> GetMatrix(const Jpeg& jpeg, size_t& ind, const size_t table_id[2], int& prev_dc,
-                           size_t quant) {
-    std::vector<int> matrix;
-    matrix.reserve(kMatrixSquare);
+void SkipMcu(const Frame& frame, BitReader& reader, int* prev_dc, BlockCounters& counters) {
+    for (size_t i = 0; i < frame.components.size(); ++i) {
+        const auto& comp = frame.components[i];
+        for (size_t block = 0; block < comp.h * comp.v; ++block) {
+            SkipMatrix(comp, reader, prev_dc[i], counters);
+        }
+    }
+}
+
+// |mcu_x| counts from frame.first_mcu_x.
+void DecodeMcu(const Frame& frame, BitReader& reader, int* prev_dc, McuRow& row, int mcu_x,
+               BlockCounters& counters) {
+    for (size_t i = 0; i < frame.components.size(); ++i) {
+        const auto& comp = frame.components[i];
+        for (size_t y = 0; y < comp.v; ++y) {
+            for (size_t x = 0; x < comp.h; ++x) {
+                size_t block = y * comp.blocks_x + mcu_x * comp.h + x;
+                row.last[i][block] = GetMatrix(comp, reader, prev_dc[i],
+                                               row.coeffs[i].data() + block * kMatrixSquare,
+                                               counters);
+            }
+        }
+    }
+}
+
+// Restart interval |index| of the current scan, without the RSTn marker that ends it.
+std::span<const uint8_t> RestartSegment(const Sos& sos, size_t index) {
+    size_t from = index ? sos.restarts_[index - 1] : 0;
+    // The next interval starts right after its two byte RSTn marker.
+    size_t to = index < sos.restarts_.size() ? sos.restarts_[index] - 2 : sos.data_.size();
+    return sos.data_.subspan(from, to - from);
+}
 
-    while (matrix.size() < kMatrixSquare) {
-        size_t table_class = matrix.empty() ? 0 : 1;
-        size_t id = table_id[table_class];
+// The entropy-coded data split into restart intervals. Every interval starts byte aligned
+// with zero DC predictions, so intervals can be decoded independently of each other, and
+// intervals before the first one that is needed are never read.
+class Scan {
+public:
+    // The segments are allocated from |memory|.
+    Scan(const Jpeg& jpeg, const Frame& frame, std::pmr::memory_resource* memory)
+        : sos_(jpeg.sos_), frame_(frame), segments_(memory), saved_(memory) {
+        size_t mcus = static_cast<size_t>(frame.len_h) * frame.len_v;
+        interval_ = jpeg.restart_.mcus_ ? jpeg.restart_.mcus_ : mcus;
+        segments_.resize((mcus - 1) / interval_ + 1);
+    }
 
-        auto& tree = jpeg.huff_tables_.data_[table_class][id].tree_;
+    // Upper bound of what the constructor and TryDecode() allocate.
+    static size_t Bytes(const Jpeg& jpeg, const Frame& frame) {
+        size_t mcus = static_cast<size_t>(frame.len_h) * frame.len_v;
+        size_t interval = jpeg.restart_.mcus_ ? jpeg.restart_.mcus_ : mcus;
+        return 2 * ((mcus - 1) / interval + 1) * sizeof(Segment);
+    }
 
-        int value;
-        while (!tree.Move(GetBit(jpeg.sos_.data_, ind), value)) {
+    // Only meaningful once the whole scan is there.
+    void CheckRestarts() const {
+        if (sos_.restarts_.size() + 1 < segments_.size()) {
+            throw std::invalid_argument("Missing restart marker");
         }
+    }
 
-        if (!table_class) {
-            matrix.push_back(GetCoeff(jpeg.sos_.data_, ind, value));
+    // Decodes the MCUs with raster indices [begin, end) into |rows|, rows[0] being MCU row
+    // |first_row|. MCUs outside the output columns, and those between the start of an
+    // interval and |begin|, are only walked over. Intervals touched by the range are decoded
+    // in parallel on |pool|.
+    void Decode(size_t begin, size_t end, std::vector<McuRow>& rows, int first_row,
+                ThreadPool* pool) {
+        size_t first = begin / interval_;
+        size_t count = (end - 1) / interval_ - first + 1;
+
+        auto decode = [&](size_t i) {
+            size_t index = first + i;
+            size_t to = std::min(end, (index + 1) * interval_);
+            auto& segment = GetSegment(index);
+            for (size_t mcu = segment.next; mcu < to; ++mcu) {
+                int mcu_y = mcu / frame_.len_h;
+                int mcu_x = mcu % frame_.len_h - frame_.first_mcu_x;
+                if (mcu < begin || mcu_x < 0 || mcu_x >= frame_.mcus_x) {
+                    SkipMcu(frame_, *segment.reader, segment.prev_dc.data(), segment.counters);
+                } else {
+                    DecodeMcu(frame_, *segment.reader, segment.prev_dc.data(),
+                              rows[mcu_y - first_row], mcu_x, segment.counters);
+                }
+                if constexpr (kDecodeStatsEnabled) {
+                    ++segment.counters.mcus;
+                }
+            }
+            segment.next = to;
+            if (to == (index + 1) * interval_) {
+                segment.reader.reset();
+            }
+        };
+
+        if (pool && count > 1) {
+            // By reference, so the std::function doesn't allocate.
+            pool->ParallelFor(count, std::ref(decode));
         } else {
-            int zeros = (value >> 4) & 15;
-            int len = value & 15;
+            for (size_t i = 0; i < count; ++i) {
+                decode(i);
+            }
+        }
+    }
+
+    // Decode for a scan that is still arriving, without threads. If the data received so
+    // far runs out, every segment is left as it was and false is returned.
+    bool TryDecode(size_t begin, size_t end, std::vector<McuRow>& rows, int first_row) {
+        size_t first = begin / interval_;
+        size_t last = (end - 1) / interval_;
+        if (last > sos_.restarts_.size()) {
+            return false;
+        }
+
+        saved_.assign(segments_.begin() + first, segments_.begin() + last + 1);
+        try {
+            Decode(begin, end, rows, first_row, nullptr);
+            return true;
+        } catch (const std::invalid_argument&) {
+            // Genuinely broken data fails again once the scan is complete.
+            std::move(saved_.begin(), saved_.end(), segments_.begin() + first);
+            return false;
+        }
+    }
 
-            for (int i = 0; i < zeros; ++i) {
-                matrix.push_back(0);
+    // Follows sos.data_ after it was moved or extended.
+    void Rebase() {
+        for (size_t index = 0; index < segments_.size(); ++index) {
+            if (segments_[index].reader) {
+                auto data = RestartSegment(sos_, index);
+                segments_[index].reader->Rebase(data.data(), data.size());
             }
+        }
+    }
+
+    void AddCounters(DecodeStats& stats) const {
+        for (const auto& segment : segments_) {
+            segment.counters.AddTo(stats);
+        }
+    }
+
+private:
+    struct Segment {
+        std::optional<BitReader> reader;
+        std::array<int, kMaxScanComponents> prev_dc = {};
+        // Raster index of the MCU the reader is at.
+        size_t next = 0;
+        bool started = false;
+        BlockCounters counters;
+    };
+
+    Segment& GetSegment(size_t index) {
+        auto& segment = segments_[index];
+        if (!segment.started) {
+            auto data = RestartSegment(sos_, index);
+            segment.reader.emplace(data.data(), data.size());
+            segment.next = index * interval_;
+            segment.started = true;
+        }
+        return segment;
+    }
+
+    const Sos& sos_;
+    const Frame& frame_;
+    size_t interval_;
+    std::pmr::vector<Segment> segments_;
+    // Segments before a TryDecode, kept to reuse the memory.
+    std::pmr::vector<Segment> saved_;
+};
+
+// The whole-image coefficient buffer of a progressive JPEG: every block of every component
+// on the padded MCU grid, in zigzag order and still quantized, as refined so far.
+class Coefficients {
+public:
+    Coefficients(const Frame& frame, std::vector<int16_t>& storage) : data_(storage) {
+        size_t size = 0;
+        for (size_t i = 0; i < frame.components.size(); ++i) {
+            const auto& comp = frame.components[i];
+            offsets_[i] = size;
+            blocks_x_[i] = frame.len_h * comp.h;
+            size += frame.len_h * comp.h * frame.len_v * comp.v * kMatrixSquare;
+        }
+        data_.assign(size, 0);
+    }
+
+    static size_t Bytes(const Frame& frame) {
+        size_t size = 0;
+        for (const auto& comp : frame.components) {
+            size += frame.len_h * comp.h * frame.len_v * comp.v * kMatrixSquare;
+        }
+        return size * sizeof(int16_t);
+    }
+
+    int16_t* Block(size_t comp, size_t block_y, size_t block_x) {
+        return data_.data() + offsets_[comp] +
+               (block_y * blocks_x_[comp] + block_x) * kMatrixSquare;
+    }
+
+private:
+    std::vector<int16_t>& data_;
+    std::array<size_t, kMaxScanComponents> offsets_;
+    std::array<size_t, kMaxScanComponents> blocks_x_;
+};
+
+// One pass of a progressive scan over one block, after G.1.2 of the standard. Every pass
+// reads its coefficients through DecodeCoeff, the same table lookup baseline blocks use.
+void DecodeDcFirst(const HuffmanTree& tree, BitReader& reader, int& prev_dc, int al,
+                   int16_t* block, BlockCounters& counters) {
+    int coeff;
+    if (tree.DecodeCoeff(reader, coeff) >> 4) {
+        throw std::invalid_argument("Broken DC coefficient length");
+    }
+    if constexpr (kDecodeStatsEnabled) {
+        ++counters.symbols;
+    }
+    prev_dc += coeff;
+    block[0] = prev_dc * (1 << al);
+}
 
-            if (len == 0 && zeros == 0) {
-                while (matrix.size() < kMatrixSquare) {
-                    matrix.push_back(0);
+void DecodeDcRefine(BitReader& reader, int al, int16_t* block) {
+    if (reader.GetBit()) {
+        block[0] |= 1 << al;
+    }
+}
+
+void DecodeAcFirst(const HuffmanTree& tree, BitReader& reader, int ss, int se, int al,
+                   int& eob_run, int16_t* block, BlockCounters& counters) {
+    if (eob_run) {
+        --eob_run;
+        if constexpr (kDecodeStatsEnabled) {
+            ++counters.eob_blocks;
+        }
+        return;
+    }
+
+    for (int k = ss; k <= se; ++k) {
+        int coeff;
+        int symbol = tree.DecodeCoeff(reader, coeff);
+        int run = symbol >> 4;
+        if constexpr (kDecodeStatsEnabled) {
+            ++counters.symbols;
+        }
+        if (symbol & 15) {
+            k += run;
+            if (k > se) {
+                throw std::invalid_argument("Matrix has invalid size");
+            }
+            block[k] = coeff * (1 << al);
+        } else if (run == 15) {
+            k += 15;
+        } else {
+            // This block ends the first of 2^run + extra blocks without further coefficients.
+            if constexpr (kDecodeStatsEnabled) {
+                ++counters.eob_blocks;
+            }
+            eob_run = (1 << run) - 1;
+            if (run) {
+                eob_run += reader.GetBits(run);
+            }
+            return;
+        }
+    }
+}
+
+// Adds the next bit to a coefficient that is already nonzero.
+void RefineNonZero(BitReader& reader, int16_t& coeff, int bit) {
+    if (reader.GetBit() && !(coeff & bit)) {
+        coeff += coeff >= 0 ? bit : -bit;
+    }
+}
+
+void DecodeAcRefine(const HuffmanTree& tree, BitReader& reader, int ss, int se, int al,
+                    int& eob_run, int16_t* block, BlockCounters& counters) {
+    int bit = 1 << al;
+    int k = ss;
+
+    if (!eob_run) {
+        for (; k <= se; ++k) {
+            // A size 1 symbol comes with the sign bit of a newly nonzero coefficient, which
+            // DecodeCoeff already extends to +1 or -1.
+            int coeff;
+            int symbol = tree.DecodeCoeff(reader, coeff);
+            int run = symbol >> 4;
+            int size = symbol & 15;
+            if constexpr (kDecodeStatsEnabled) {
+                ++counters.symbols;
+            }
+            if (size > 1) {
+                throw std::invalid_argument("Broken refinement coefficient");
+            }
+            if (!size && run != 15) {
+                eob_run = 1 << run;
+                if (run) {
+                    eob_run += reader.GetBits(run);
                 }
                 break;
-            } else {
-                matrix.push_back(GetCoeff(jpeg.sos_.data_, ind, len));
+            }
+
+            // Skips |run| zero coefficients, refining the nonzero ones on the way.
+            for (; k <= se; ++k) {
+                if (block[k]) {
+                    RefineNonZero(reader, block[k], bit);
+                } else if (--run < 0) {
+                    break;
+                }
+            }
+            if (size) {
+                if (k > se) {
+                    throw std::invalid_argument("Matrix has invalid size");
+                }
+                block[k] = coeff * bit;
             }
         }
     }
 
-    if (matrix.size() != kMatrixSquare) {
-        throw std::invalid_argument("Matrix has invalid size");
+    if (eob_run) {
+        for (; k <= se; ++k) {
+            if (block[k]) {
+                RefineNonZero(reader, block[k], bit);
+            }
+        }
+        --eob_run;
+        if constexpr (kDecodeStatsEnabled) {
+            ++counters.eob_blocks;
+        }
     }
+}
 
-    prev_dc += matrix[0];
-    matrix[0] = prev_dc;
+const HuffmanTree& ScanTree(const Jpeg& jpeg, size_t comp, size_t table_class) {
+    size_t id = jpeg.sos_.channels_[comp].table_id[table_class];
+    const auto& tables = jpeg.huff_tables_.data_[table_class];
+    if (id >= tables.size() || !tables[id].defined_) {
+        throw std::invalid_argument(table_class ? "Invalid AC channel id"
+                                                : "Invalid DC channel id");
+    }
+    return tables[id].tree_;
+}
 
-    const auto& quant_table = jpeg.tables_.tables_[quant].data_;
-    for (int i = 0; i < kMatrixSquare; ++i) {
-        matrix[i] *= quant_table[i];
+// Decodes the scan currently in jpeg.sos_ into |coeffs|.
+void DecodeProgressiveScan(const Jpeg& jpeg, const Frame& frame, Coefficients& coeffs,
+                           BlockCounters& counters) {
+    const auto& sos = jpeg.sos_;
+    int ss = sos.ss_, se = sos.se_, ah = sos.ah_, al = sos.al_;
+    bool dc = ss == 0;
+    if (se > 63 || ss > se || (dc && se != 0) || (!dc && sos.components_.size() != 1) ||
+        al > 13 || (ah && ah != al + 1)) {
+        throw std::invalid_argument("Invalid progressive scan");
     }
 
-    matrix = Reorder(matrix);
+    std::array<const HuffmanTree*, kMaxScanComponents> trees;
+    for (size_t i = 0; i < sos.components_.size(); ++i) {
+        // DC refinement reads raw bits only.
+        trees[i] = dc && ah ? nullptr : &ScanTree(jpeg, sos.components_[i], dc ? 0 : 1);
+    }
 
-    std::vector<double> input(kMatrixSquare);
-    for (int i = 0; i < kMatrixSquare; ++i) {
-        input[i] = static_cast<double>(matrix[i]);
+    // Interleaved scans walk MCUs like baseline, a single component scan walks the blocks
+    // that cover the component, one block per MCU.
+    bool interleaved = sos.components_.size() > 1;
+    size_t blocks_x = 0;
+    size_t mcus = static_cast<size_t>(frame.len_h) * frame.len_v;
+    if (!interleaved) {
+        const auto& comp = frame.components[sos.components_[0]];
+        size_t width = (static_cast<size_t>(frame.width) * comp.h + frame.max_h - 1) / frame.max_h;
+        size_t high = (static_cast<size_t>(frame.high) * comp.v + frame.max_v - 1) / frame.max_v;
+        blocks_x = (width + kMatrixSide - 1) / kMatrixSide;
+        mcus = blocks_x * ((high + kMatrixSide - 1) / kMatrixSide);
     }
 
-    std::vector<double> output(kMatrixSquare);
+    size_t interval = jpeg.restart_.mcus_ ? jpeg.restart_.mcus_ : mcus;
+    size_t intervals = (mcus - 1) / interval + 1;
+    if (sos.restarts_.size() + 1 < intervals) {
+        throw std::invalid_argument("Missing restart marker");
+    }
 
-    DctCalculator calc(kMatrixSide, &input, &output);
-    calc.Inverse();
+    auto decode_block = [&](size_t i, BitReader& reader, int& prev_dc, int& eob_run,
+                            int16_t* block) {
+        if constexpr (kDecodeStatsEnabled) {
+            ++counters.blocks;
+        }
+        if (dc && !ah) {
+            DecodeDcFirst(*trees[i], reader, prev_dc, al, block, counters);
+        } else if (dc) {
+            DecodeDcRefine(reader, al, block);
+        } else if (!ah) {
+            DecodeAcFirst(*trees[i], reader, ss, se, al, eob_run, block, counters);
+        } else {
+            DecodeAcRefine(*trees[i], reader, ss, se, al, eob_run, block, counters);
+        }
+    };
 
-    for (size_t i = 0; i < kMatrixSquare; ++i) {
-        matrix[i] = std::max(0, std::min(255, static_cast<int>(std::round(output[i] + 128))));
+    std::array<int, kMaxScanComponents> prev_dc;
+    for (size_t index = 0; index < intervals; ++index) {
+        auto data = RestartSegment(sos, index);
+        BitReader reader(data.data(), data.size());
+        prev_dc.fill(0);
+        int eob_run = 0;
+
+        size_t end = std::min(mcus, (index + 1) * interval);
+        for (size_t mcu = index * interval; mcu < end; ++mcu) {
+            if constexpr (kDecodeStatsEnabled) {
+                ++counters.mcus;
+            }
+            if (!interleaved) {
+                decode_block(0, reader, prev_dc[0], eob_run,
+                             coeffs.Block(sos.components_[0], mcu / blocks_x, mcu % blocks_x));
+                continue;
+            }
+
+            size_t mcu_y = mcu / frame.len_h, mcu_x = mcu % frame.len_h;
+            for (size_t i = 0; i < sos.components_.size(); ++i) {
+                size_t c = sos.components_[i];
+                const auto& comp = frame.components[c];
+                for (size_t y = 0; y < comp.v; ++y) {
+                    for (size_t x = 0; x < comp.h; ++x) {
+                        decode_block(i, reader, prev_dc[i], eob_run,
+                                     coeffs.Block(c, mcu_y * comp.v + y, mcu_x * comp.h + x));
+                    }
+                }
+            }
+        }
     }
+}
 
-    // DLOG(INFO) << "DONE";
-    return matrix;
+// Dequantizes the output columns of MCU row |mcu_y| from the progressive buffer into |row|.
+void LoadMcuRow(const Frame& frame, Coefficients& coeffs, McuRow& row, int mcu_y) {
+    for (size_t i = 0; i < frame.components.size(); ++i) {
+        const auto& comp = frame.components[i];
+        const auto& quant = *comp.quant;
+        for (size_t y = 0; y < comp.v; ++y) {
+            for (size_t x = 0; x < comp.blocks_x; ++x) {
+                const int16_t* block =
+                    coeffs.Block(i, mcu_y * comp.v + y, frame.first_mcu_x * comp.h + x);
+                size_t index = y * comp.blocks_x + x;
+                row.last[i][index] =
+                    DequantizeBlock(block, quant, row.coeffs[i].data() + index * kMatrixSquare);
+            }
+        }
+    }
 }
-struct ColorMatrix {
-    std::vector<std::vector<std::vector<int>>> data_;
+
+void ReconstructMcuRow(const Frame& frame, const Idct& idct, McuRow& row) {
+    for (size_t i = 0; i < frame.components.size(); ++i) {
+        const auto& comp = frame.components[i];
+        size_t side = comp.block;
+        size_t stride = comp.blocks_x * side;
+        for (size_t y = 0; y < comp.v; ++y) {
+            for (size_t x = 0; x < comp.blocks_x; ++x) {
+                size_t block = y * comp.blocks_x + x;
+                idct.Inverse(row.coeffs[i].data() + block * kMatrixSquare,
+                             row.samples[i].data() + y * side * stride + x * side, stride, side,
+                             row.last[i][block]);
+                if constexpr (kDecodeStatsEnabled) {
+                    row.counters.dc_only_blocks += row.last[i][block] == 0;
+                }
+            }
+        }
+    }
+}
+
+// First and last + 1 row inside MCU row |mcu_y| that belong to the output.
+std::pair<int, int> OutputRows(const Frame& frame, int mcu_y) {
+    int mcu_high = frame.max_v * frame.block;
+    int top = std::max(0, frame.crop_y - mcu_y * mcu_high);
+    int bottom = std::min(mcu_high, frame.crop_y + frame.out_high - mcu_y * mcu_high);
+    return {top, bottom};
+}
+
+// Chroma of one output row: the sample of output column x is data[(x + phase) >> shift].
+struct ChromaSamples {
+    const uint8_t* data;
+    int shift = 0;
+    int phase = 0;
 };
 
-ColorMatrix GetBlock(const Jpeg& jpeg, size_t& ind, size_t channels, std::vector<int>& prev_dc) {
-    ColorMatrix block;
-    block.data_.resize(channels);
+// Component |i| for row |y| of MCU row |mcu_y|, upsampled as far as the color conversion
+// needs it. |left| is output column 0 inside the decoded MCU columns, |buffer| has
+// 2 * out_width + 16 bytes for this component.
+ChromaSamples ChromaRow(const Frame& frame, const McuRow& row, int mcu_y, size_t i, int y,
+                        int left, uint8_t* buffer) {
+    const auto& comp = frame.components[i];
+    size_t stride = comp.blocks_x * comp.block;
+    const uint8_t* plane = row.samples[i].data();
+    int cy = y / comp.up_v;
+    const uint8_t* near = plane + cy * stride;
 
-    for (size_t i = 0; i < channels; ++i) {
-        block.data_[i].resize(jpeg.sos_.channels_[i].h * jpeg.sos_.channels_[i].v);
-        for (auto& matrix : block.data_[i]) {
-            matrix = GetMatrix(jpeg, ind, jpeg.sos_.channels_[i].table_id, prev_dc[i],
-                               jpeg.sos_.channels_[i].quant_identifier_);
+    if (!comp.fancy) {
+        if (comp.up_h == 1 || comp.up_h == 2) {
+            int shift = comp.up_h - 1;
+            return {near + (left >> shift), shift, left & shift};
+        }
+        for (int x = 0; x < frame.out_width; ++x) {
+            buffer[x] = near[(left + x) / comp.up_h];
         }
+        return {buffer};
     }
 
-    return block;
-}
+    // The other chroma row of the blend: above for the upper output row, below for the lower
+    // one. The image border repeats the edge row.
+    const uint8_t* far = near;
+    bool lower = y % 2;
+    if (comp.up_v == 2) {
+        int rows = comp.v * comp.block;
+        int other = lower ? cy + 1 : cy - 1;
+        int global = mcu_y * rows + other;
+        if (global < 0 || global >= comp.high) {
+            far = near;
+        } else if (other < 0) {
+            far = row.above[i].data();
+        } else if (other >= rows) {
+            far = row.below[i].data();
+        } else {
+            far = plane + other * stride;
+        }
+    }
+
+    if (comp.up_h == 1) {
+        FancyUpsampleH1V2(near + left, far + left, frame.out_width, lower, buffer);
+        return {buffer};
+    }
 
-void GetCoordinate(int y, int max_v, int v, int& ins, int& ind) {
-    if (max_v == 2 && v == 2) {
-        ind = y / kMatrixSide, ins = y % kMatrixSide;
-    } else if (max_v == 2 && v == 1) {
-        ind = 0, ins = y / 2;
-    } else if (max_v == 1 && v == 1) {
-        ind = 0, ins = y;
+    // Padded copies of the chroma samples under the output and one more on each side,
+    // repeated at the image border.
+    int first = left / 2;
+    int last = (left + frame.out_width - 1) / 2;
+    int count = last - first + 1;
+    int end = comp.width - frame.first_mcu_x * static_cast<int>(comp.h) * comp.block;
+    auto pad = [&](const uint8_t* samples, uint8_t* out) {
+        out[0] = samples[std::max(first - 1, 0)];
+        std::memcpy(out + 1, samples + first, count);
+        out[count + 1] = samples[std::min(last + 1, end - 1)];
+        return out + 1;
+    };
+    uint8_t* upsampled = buffer;
+    const uint8_t* padded_near = pad(near, buffer + 2 * count);
+    if (comp.up_v == 2) {
+        const uint8_t* padded_far = pad(far, buffer + 3 * count + 2);
+        FancyUpsampleH2V2(padded_near, padded_far, count, upsampled);
     } else {
-        throw std::logic_error("Broken 1 <= v <= max_v <= 2");
+        FancyUpsampleH2V1(padded_near, count, upsampled);
     }
+    return {upsampled, 0, left & 1};
 }
 
-void GetCoordinate(int y, int x, int max_v, int max_h, int v, int h, int& ins, int& ind) {
-    int ins_y, ins_x, ind_y, ind_x;
-    GetCoordinate(y, max_v, v, ins_y, ind_y);
-    GetCoordinate(x, max_h, h, ins_x, ind_x);
-    ind = (h == 2 && v == 2) ? ind_y * 2 + ind_x : ind_y + ind_x;
-    ins = ins_y * kMatrixSide + ins_x;
+// |samples| one per output column, expanded into |buffer| (|width| bytes) if they are 2x
+// replicated.
+const uint8_t* ExpandSamples(const ChromaSamples& samples, int width, uint8_t* buffer) {
+    if (!samples.shift) {
+        return samples.data + samples.phase;
+    }
+    for (int x = 0; x < width; ++x) {
+        buffer[x] = samples.data[(x + samples.phase) >> 1];
+    }
+    return buffer;
 }
 
-std::vector<int> GetPixel(const Jpeg& jpeg, int y, int x, const std::vector<ColorMatrix>& blocks,
-                          int max_v, int max_h, int len_v, int len_h) {
-    int y_ind = y / (max_v * kMatrixSide), x_ind = x / (max_h * kMatrixSide);
-    int y_ins = y % (max_v * kMatrixSide), x_ins = x % (max_h * kMatrixSide);
+// Upsamples the component planes and converts the rows of MCU row |mcu_y| that are inside
+// the output into row.pixels. Gray rows are copied, color rows go through YCbCrToRgbRow,
+// which replicates 2x subsampled chroma itself. Luma sampled lower than chroma (e.g. Y 1x1
+// with Cb and Cr 2x2) is upsampled like chroma first.
+void ConvertMcuRow(const Frame& frame, McuRow& row, int mcu_y) {
+    size_t channels = frame.components.size();
+    size_t row_bytes = frame.out_width * channels;
+    // Output column 0 inside the decoded MCU columns.
+    int left = frame.crop_x - frame.first_mcu_x * frame.max_h * frame.block;
+    auto [top, bottom] = OutputRows(frame, mcu_y);
 
-    int ind_block = y_ind * len_h + x_ind;
+    const auto& first = frame.components[0];
+    size_t buffer_size = 2 * frame.out_width + 16;
+    uint8_t* wide = row.chroma.data() + channels * buffer_size;
 
-    std::vector<int> res(blocks[ind_block].data_.size());
-    for (int i = 0; i < res.size(); ++i) {
-        int v = jpeg.sos_.channels_[i].v, h = jpeg.sos_.channels_[i].h;
+    for (int y = top; y < bottom; ++y) {
+        uint8_t* out = row.pixels.data() + y * row_bytes;
+        const uint8_t* luma;
+        if (first.up_h == 1 && first.up_v == 1) {
+            luma = row.samples[0].data() + y * first.blocks_x * first.block + left;
+        } else {
+            uint8_t* buffer = row.chroma.data();
+            luma = ExpandSamples(ChromaRow(frame, row, mcu_y, 0, y, left, buffer),
+                                 frame.out_width, buffer);
+        }
+        if (channels == 1) {
+            std::memcpy(out, luma, frame.out_width);
+            continue;
+        }
 
-        int ind, ins;
-        GetCoordinate(y_ins, x_ins, max_v, max_h, v, h, ins, ind);
+        ChromaSamples chroma[2];
+        for (size_t i = 1; i < 3; ++i) {
+            uint8_t* buffer = row.chroma.data() + i * buffer_size;
+            ChromaSamples samples = ChromaRow(frame, row, mcu_y, i, y, left, buffer);
+            if (!samples.shift) {
+                samples = {samples.data + samples.phase};
+            }
+            chroma[i - 1] = samples;
+        }
 
-        res[i] = blocks[ind_block].data_[i][ind][ins];
-    }
+        // Both chroma components have to be replicated by the kernel or neither.
+        if (chroma[0].shift != chroma[1].shift) {
+            for (size_t i = 0; i < 2; ++i) {
+                if (chroma[i].shift) {
+                    chroma[i] = {ExpandSamples(chroma[i], frame.out_width, wide)};
+                }
+            }
+        }
 
-    return res;
+        // The kernel expects the output to start on the first column of a chroma sample.
+        int x = 0;
+        int shift = chroma[0].shift;
+        int phase = chroma[0].phase;
+        if (shift && phase) {
+            YCbCrToRgbRow(luma, chroma[0].data, chroma[1].data, 1, 0, out);
+            x = 1;
+        }
+        int sample = (x + phase) >> shift;
+        YCbCrToRgbRow(luma + x, chroma[0].data + sample, chroma[1].data + sample,
+                      frame.out_width - x, shift, out + 3 * x);
+    }
 }
 
-RGB MakeRGB(std::vector<int> channels) {
-    RGB color;
-    if (channels.size() == 1) {
-        color.r = color.g = color.b = channels[0];
-    } else if (channels.size() == 3) {
-        double y = channels[0], cb = channels[1], cr = channels[2];
-        color.r = round(y + 1.402 * (cr - 128));
-        color.g = round(y - 0.34414 * (cb - 128) - 0.71414 * (cr - 128));
-        color.b = round(y + 1.772 * (cb - 128));
-    } else {
-        throw std::invalid_argument("Invalid channel amount");
+// Copies the chroma rows that fancy vertical upsampling of |upper| and |lower|, two
+// consecutive MCU rows, takes from each other.
+void LinkMcuRows(const Frame& frame, McuRow& upper, McuRow& lower) {
+    for (size_t i = 0; i < frame.components.size(); ++i) {
+        const auto& comp = frame.components[i];
+        if (!comp.fancy || comp.up_v != 2) {
+            continue;
+        }
+        size_t stride = comp.blocks_x * comp.block;
+        size_t rows = comp.v * comp.block;
+        std::copy_n(upper.samples[i].data() + (rows - 1) * stride, stride,
+                    lower.above[i].data());
+        std::copy_n(lower.samples[i].data(), stride, upper.below[i].data());
     }
+}
 
-    color.r = std::max(0, std::min(color.r, 255));
-    color.g = std::max(0, std::min(color.g, 255));
-    color.b = std::max(0, std::min(color.b, 255));
-    return color;
+// Passes the converted rows of MCU row |mcu_y| to |sink|, has to be called in row order.
+void EmitMcuRow(const Frame& frame, const McuRow& row, int mcu_y, RowSink& sink) {
+    size_t row_bytes = frame.out_width * frame.components.size();
+    int mcu_high = frame.max_v * frame.block;
+    auto [top, bottom] = OutputRows(frame, mcu_y);
+
+    for (int y = top; y < bottom; ++y) {
+        sink.WriteRow(mcu_y * mcu_high + y - frame.crop_y,
+                      {row.pixels.data() + y * row_bytes, row_bytes});
+    }
 }
 
-Image Decode(std::istream& stream) {
+// Collects the rows into an Image for the non-streaming Decode.
+class ImageSink : public RowSink {
+public:
+    explicit ImageSink(Image& image) : image_(image) {
+    }
+
+    void Begin(const ImageHeader& header) override {
+        image_.SetSize(header.width, header.height, header.format);
+        image_.SetComment(header.comment);
+    }
+
+    void WriteRow(size_t y, std::span<const uint8_t> row) override {
+        std::copy(row.begin(), row.end(), image_.Row(y));
+    }
+
+private:
+    Image& image_;
+};
+
+class DecodeScratch::Impl {
+public:
     Jpeg jpeg;
-    Input input(&stream);
+    std::vector<McuRow> rows;
+    // Whole-image coefficients of progressive files.
+    std::vector<int16_t> coefficients;
+    // The file read from a stream or received by IncrementalDecoder.
+    std::vector<uint8_t> buffer;
+    // The rest of the state of a decode, released when the next one starts.
+    Arena arena;
+};
 
-    Reader reader(input, jpeg);
+DecodeScratch::DecodeScratch() : impl_(new Impl()) {
+}
 
-    while (reader.ReadField()) {
+DecodeScratch::~DecodeScratch() = default;
+
+// One decode from the first byte to sink.End(). DecodeRows hands it the whole file at once,
+// IncrementalDecoder whatever has arrived so far.
+class DecodeState {
+public:
+    DecodeState(RowSink& sink, const DecodeOptions& options, bool incremental)
+        : sink_(sink),
+          options_(options),
+          idct_(options.idct),
+          scratch_(Scratch(options, own_scratch_)),
+          jpeg_(scratch_.jpeg),
+          input_(nullptr, 0),
+          reader_(input_, jpeg_, incremental ? ReadMode::kIncremental : ReadMode::kFull) {
+        jpeg_.Reset();
+        scratch_.arena.Release();
+        if (stats_) {
+            *stats_ = {};
+        }
+        if (options.limits.timeout.count()) {
+            deadline_ = std::chrono::steady_clock::now() + options.limits.timeout;
+        }
+
+        pool_ = options.pool;
+        if (!pool_ && options.threads != 1) {
+            own_pool_.reset(new ThreadPool(options.threads));
+            pool_ = own_pool_.get();
+        }
     }
 
-    Image image;
+    // options.scratch, or |own| created for this decode.
+    static DecodeScratch::Impl& Scratch(const DecodeOptions& options,
+                                        std::unique_ptr<DecodeScratch>& own) {
+        if (options.scratch) {
+            return *options.scratch->impl_;
+        }
+        own.reset(new DecodeScratch());
+        return *own->impl_;
+    }
 
-    if (!jpeg.begin_.Exists()) {
-        throw std::invalid_argument("No begin");
+    // Counts the image |sink| fills in towards DecodeLimits::max_memory, call before Pump().
+    void CountOutputImage() {
+        count_output_ = true;
     }
 
-    if (!jpeg.end_.Exists()) {
-        throw std::invalid_argument("No end");
+    // Decodes as far as |data| allows and emits every MCU row that is complete. |data| is
+    // all of the input so far: earlier bytes may have moved but never change. With |last|
+    // the file has to be complete. Returns true once sink.End() was called.
+    bool Pump(std::span<const uint8_t> data, bool last) {
+        if (finished_) {
+            return true;
+        }
+        StageTimer total(Time(&DecodeStats::total_seconds));
+        Rebase(data);
+
+        while (!done_reading_) {
+            StageTimer parse(Time(&DecodeStats::parse_seconds));
+            bool more;
+            if (jpeg_.sos_.open_) {
+                more = reader_.ContinueScan();
+            } else if (reader_.FieldAvailable()) {
+                more = reader_.ReadField();
+            } else if (last) {
+                throw std::invalid_argument("Input Ended");
+            } else {
+                return false;
+            }
+            parse.Stop();
+            done_reading_ = !more;
+            CheckLimits();
+            OnField();
+
+            if (jpeg_.sos_.open_) {
+                if (last) {
+                    throw std::invalid_argument("Input Ended");
+                }
+                if (scan_) {
+                    DecodeScanRows();
+                }
+                return false;
+            }
+        }
+
+        Finish();
+        return true;
     }
 
-    if (jpeg.comment_.Exists()) {
-        image.SetComment(jpeg.comment_.text_);
+    const ImageHeader& Header() const {
+        return header_;
     }
 
-    int width, high;
+    size_t RowsDone() const {
+        return rows_done_;
+    }
 
-    if (!jpeg.info_.Exists()) {
-        throw std::invalid_argument("No image info");
-    } else {
-        width = jpeg.info_.width_, high = jpeg.info_.high_;
-        if (width == 0 || high == 0) {
+private:
+    void Rebase(std::span<const uint8_t> data) {
+        input_.Rebind(data.data(), data.size());
+        auto& sos = jpeg_.sos_;
+        if (sos.Exists()) {
+            sos.data_ = data.subspan(sos.offset_, sos.data_.size());
+        }
+    }
+
+    void CheckInfo() const {
+        if (!jpeg_.info_.Exists()) {
+            throw std::invalid_argument("No image info");
+        } else if (jpeg_.info_.width_ == 0 || jpeg_.info_.high_ == 0) {
             throw std::invalid_argument("Empty size");
+        } else if (jpeg_.info_.precision_ != 8) {
+            throw std::invalid_argument("Unsupported precision");
         }
+    }
 
-        image.SetSize(width, high);
+    bool Progressive() const {
+        return jpeg_.info_.marker_ == 0xC2;
     }
 
-    size_t channels = jpeg.sos_.channels_.size();
+    // Everything that can be checked from the sections read so far.
+    void CheckLimits() const {
+        const auto& limits = options_.limits;
+        const auto& info = jpeg_.info_;
+        if (limits.max_pixels && info.Exists() &&
+            static_cast<uint64_t>(info.width_) * info.high_ > limits.max_pixels) {
+            throw DecodeLimitError("Image has more pixels than the limit");
+        }
+        const auto& sos = jpeg_.sos_;
+        if (limits.max_scan_bytes && sos.Exists()) {
+            // Progressive scans are added to scan_bytes_ once they are decoded.
+            size_t current = Progressive() && sos.scans_ == scans_ ? 0 : sos.data_.size();
+            if (scan_bytes_ + current > limits.max_scan_bytes) {
+                throw DecodeLimitError("Scan data exceeds the limit");
+            }
+        }
+        CheckDeadline();
+    }
 
-    int max_h = 1, max_v = 1;
+    void CheckDeadline() const {
+        const auto& limits = options_.limits;
+        if (limits.cancel && limits.cancel->load(std::memory_order_relaxed)) {
+            throw DecodeLimitError("Decode cancelled");
+        }
+        if (limits.timeout.count() && std::chrono::steady_clock::now() > deadline_) {
+            throw DecodeLimitError("Decode timed out");
+        }
+    }
 
-    for (size_t i = 0; i < channels; ++i) {
-        auto chan = jpeg.sos_.channels_[i];
-        if (chan.table_id[0] >= jpeg.huff_tables_.data_[0].size()) {
-            throw std::invalid_argument("Invalid DC channel id");
+    // Before the buffers for |slots| MCU rows (and the coefficients) are allocated.
+    void CheckMemory(size_t slots) const {
+        size_t limit = options_.limits.max_memory;
+        if (!limit) {
+            return;
         }
-        if (chan.table_id[1] >= jpeg.huff_tables_.data_[1].size()) {
-            throw std::invalid_argument("Invalid AC channel id");
+        const Frame& frame = *frame_;
+        uint64_t bytes = static_cast<uint64_t>(slots) * McuRow::Bytes(frame);
+        if (Progressive()) {
+            bytes += Coefficients::Bytes(frame);
         }
-        if (chan.quant_identifier_ >= jpeg.tables_.tables_.size()) {
-            throw std::invalid_argument("Invalid channel Quant table id");
+        if (count_output_) {
+            bytes += static_cast<uint64_t>(frame.out_width) * frame.out_high *
+                     frame.components.size();
         }
-        if (chan.h < 1 || chan.h > 2 || chan.v < 1 || chan.v > 2) {
-            throw std::invalid_argument("Invalid channel compression");
+        if (!Progressive()) {
+            bytes += Scan::Bytes(jpeg_, frame);
+        }
+        if (bytes > limit) {
+            throw DecodeLimitError("Decoding needs more memory than the limit");
         }
+    }
 
-        max_h = std::max(max_h, static_cast<int>(chan.h));
-        max_v = std::max(max_v, static_cast<int>(chan.v));
+    // The stats field to time a stage into, null when stats are off.
+    double* Time(double DecodeStats::*seconds) const {
+        return stats_ ? &(stats_->*seconds) : nullptr;
     }
 
-    size_t ind = 0;
+    // Starts decoding at the first scan. Progressive scans are decoded into the coefficient
+    // buffer once complete, since the tables they use may be replaced before the next one.
+    void OnField() {
+        const auto& sos = jpeg_.sos_;
+        if (!sos.Exists() || (Progressive() && sos.scans_ == scans_)) {
+            return;
+        }
+        if (!frame_) {
+            Start();
+        }
+        if (Progressive()) {
+            StageTimer entropy(Time(&DecodeStats::entropy_seconds));
+            DecodeProgressiveScan(jpeg_, *frame_, *coefficients_, counters_);
+            if (stats_) {
+                stats_->bytes_scanned += sos.data_.size();
+            }
+            scan_bytes_ += sos.data_.size();
+            ++scans_;
+            CheckDeadline();
+        }
+    }
 
-    int len_v = (high - 1) / (kMatrixSide * max_v) + 1,
-        len_h = (width - 1) / (kMatrixSide * max_h) + 1;
+    void Start() {
+        if (!jpeg_.begin_.Exists()) {
+            throw std::invalid_argument("No begin");
+        }
+        CheckInfo();
 
-    int blocks_cnt = len_v * len_h;
+        frame_.emplace(GetFrame(jpeg_, options_.scale, options_.crop, options_.upsampling,
+                                &scratch_.arena));
+        const Frame& frame = *frame_;
+        next_row_ = frame.first_mcu_y;
 
-    std::vector<ColorMatrix> blocks(blocks_cnt);
-    std::vector<int> prev_dc(channels);
+        // Entropy decoding is serial (except across restart intervals), everything after it
+        // is independent per MCU row. Rows are therefore processed in bands: the serial pass
+        // fills the coefficients of a band, then the threads reconstruct its rows.
+        // Progressive files have all coefficients by the end and only load them.
+        band_ = 1;
+        if (pool_) {
+            size_t rows_per_interval = 1;
+            if (!Progressive() && jpeg_.restart_.mcus_) {
+                rows_per_interval = (jpeg_.restart_.mcus_ - 1) / frame.len_h + 1;
+            }
+            band_ = std::min<size_t>(frame.end_mcu_y - frame.first_mcu_y,
+                                     pool_->Size() * std::max(kRowsPerThread, rows_per_interval));
+        }
+        // rows[band_] holds the MCU row waiting for its lower neighbour, see ProcessRows.
+        size_t slots = band_ + (frame.context_rows ? 1 : 0);
+        CheckMemory(slots);
 
-    for (auto& block : blocks) {
-        block = GetBlock(jpeg, ind, channels, prev_dc);
+        if (Progressive()) {
+            coefficients_.emplace(frame, scratch_.coefficients);
+        } else {
+            scan_.emplace(jpeg_, frame, &scratch_.arena);
+        }
+        auto& rows = scratch_.rows;
+        if (rows.size() < slots) {
+            rows.resize(slots);
+        }
+        for (size_t i = 0; i < slots; ++i) {
+            rows[i].Resize(frame);
+        }
+
+        // The scan is read up to the last MCU of the output.
+        last_mcu_ = static_cast<size_t>(frame.end_mcu_y - 1) * frame.len_h + frame.first_mcu_x +
+                    frame.mcus_x;
     }
 
-    for (int y = 0; y < high; ++y) {
-        for (int x = 0; x < width; ++x) {
-            image.SetPixel(y, x, MakeRGB(GetPixel(jpeg, y, x, blocks, max_v, max_h, len_v, len_h)));
+    void Begin() {
+        if (jpeg_.comment_.Exists()) {
+            header_.comment = jpeg_.comment_.text_;
         }
+        size_t channels = frame_->components.size();
+        header_.width = frame_->out_width;
+        header_.height = frame_->out_high;
+        header_.format = channels == 1 ? PixelFormat::kGray8 : PixelFormat::kRGB24;
+        StageTimer output(Time(&DecodeStats::output_seconds));
+        sink_.Begin(header_);
+        begun_ = true;
+    }
+
+    // End of MCU row |row| in the scan, in raster MCUs.
+    size_t RowEnd(int row) const {
+        return std::min(static_cast<size_t>(row) * frame_->len_h, last_mcu_);
     }
 
+    // Baseline: decodes and emits every MCU row the scan received so far allows.
+    void DecodeScanRows() {
+        if (!begun_) {
+            Begin();
+        }
+        const Frame& frame = *frame_;
+        bool open = jpeg_.sos_.open_;
+        if (!open) {
+            scan_->CheckRestarts();
+        }
+        // The scan may have moved or grown since the last call.
+        scan_->Rebase();
+
+        while (next_row_ < frame.end_mcu_y) {
+            CheckDeadline();
+            int count = std::min(band_, frame.end_mcu_y - next_row_);
+            size_t begin = static_cast<size_t>(next_row_) * frame.len_h;
+            StageTimer entropy(Time(&DecodeStats::entropy_seconds));
+            if (!open) {
+                scan_->Decode(begin, RowEnd(next_row_ + count), scratch_.rows, next_row_, pool_);
+            } else {
+                // Row by row, so every complete row goes out right away.
+                int decoded = 0;
+                while (decoded < count &&
+                       scan_->TryDecode(decoded ? RowEnd(next_row_ + decoded) : begin,
+                                        RowEnd(next_row_ + decoded + 1), scratch_.rows,
+                                        next_row_)) {
+                    ++decoded;
+                }
+                if (!decoded) {
+                    return;
+                }
+                count = decoded;
+            }
+            entropy.Stop();
+            ProcessRows(next_row_, count);
+            next_row_ += count;
+        }
+    }
+
+    // Runs |task| for 0..count-1 on the pool.
+    template <class Task>
+    void ForRows(int count, const Task& task) {
+        if (pool_ && count > 1) {
+            pool_->ParallelFor(count, std::cref(task));
+        } else {
+            for (int i = 0; i < count; ++i) {
+                task(i);
+            }
+        }
+    }
+
+    void Emit(McuRow& row, int mcu_y) {
+        auto [top, bottom] = OutputRows(*frame_, mcu_y);
+        {
+            StageTimer output(Time(&DecodeStats::output_seconds));
+            EmitMcuRow(*frame_, row, mcu_y, sink_);
+        }
+        rows_done_ += std::max(bottom - top, 0);
+
+        if (stats_) {
+            row.counters.AddTo(*stats_);
+            stats_->idct_seconds += row.idct_seconds;
+            stats_->color_seconds += row.color_seconds;
+        }
+        row.counters = {};
+        row.idct_seconds = row.color_seconds = 0;
+    }
+
+    void ProcessRows(int first, int count) {
+        const Frame& frame = *frame_;
+        auto& rows = scratch_.rows;
+        auto reconstruct = [&](size_t i) {
+            StageTimer timer(stats_ ? &rows[i].idct_seconds : nullptr);
+            if (coefficients_) {
+                LoadMcuRow(frame, *coefficients_, rows[i], first + i);
+            }
+            ReconstructMcuRow(frame, idct_, rows[i]);
+        };
+
+        if (!frame.context_rows) {
+            ForRows(count, [&](size_t i) {
+                reconstruct(i);
+                StageTimer timer(stats_ ? &rows[i].color_seconds : nullptr);
+                ConvertMcuRow(frame, rows[i], first + i);
+            });
+            for (int i = 0; i < count; ++i) {
+                Emit(rows[i], first + i);
+            }
+            return;
+        }
+
+        // An MCU row can only be converted once the one below it is reconstructed, so the
+        // last row of every band waits in rows[band_] for the next band.
+        ForRows(count, reconstruct);
+        McuRow& waiting = rows[band_];
+        int offset = has_waiting_ ? 1 : 0;
+        auto ready_row = [&](int k) -> McuRow& {
+            return k < offset ? waiting : rows[k - offset];
+        };
+        bool end = first + count == frame.end_mcu_y;
+        int ready = count - 1 + offset + (end ? 1 : 0);
+        for (int k = 0; k + 1 < count + offset; ++k) {
+            LinkMcuRows(frame, ready_row(k), ready_row(k + 1));
+        }
+
+        int first_ready = first - offset;
+        ForRows(ready, [&](size_t k) {
+            McuRow& row = ready_row(k);
+            StageTimer timer(stats_ ? &row.color_seconds : nullptr);
+            ConvertMcuRow(frame, row, first_ready + k);
+        });
+        for (int k = 0; k < ready; ++k) {
+            Emit(ready_row(k), first_ready + k);
+        }
+
+        has_waiting_ = !end;
+        if (has_waiting_) {
+            std::swap(waiting, rows[count - 1]);
+        }
+    }
+
+    void Finish() {
+        if (!jpeg_.begin_.Exists()) {
+            throw std::invalid_argument("No begin");
+        }
+
+        if (!jpeg_.end_.Exists()) {
+            throw std::invalid_argument("No end");
+        }
+
+        CheckInfo();
+
+        if (!frame_) {
+            if (Progressive()) {
+                throw std::invalid_argument("No scans");
+            }
+            Start();
+        }
+
+        if (scan_) {
+            DecodeScanRows();
+        } else {
+            Begin();
+            for (; next_row_ < frame_->end_mcu_y; next_row_ += band_) {
+                CheckDeadline();
+                ProcessRows(next_row_, std::min(band_, frame_->end_mcu_y - next_row_));
+            }
+        }
+
+        {
+            StageTimer output(Time(&DecodeStats::output_seconds));
+            sink_.End();
+        }
+        finished_ = true;
+
+        if (stats_) {
+            counters_.AddTo(*stats_);
+            if (scan_) {
+                scan_->AddCounters(*stats_);
+                stats_->bytes_scanned += jpeg_.sos_.data_.size();
+            }
+            stats_->peak_arena_bytes = scratch_.arena.Used();
+        }
+    }
+
+    RowSink& sink_;
+    DecodeOptions options_;
+    Idct idct_;
+    std::unique_ptr<DecodeScratch> own_scratch_;
+    DecodeScratch::Impl& scratch_;
+    Jpeg& jpeg_;
+    Input input_;
+    Reader reader_;
+    std::unique_ptr<ThreadPool> own_pool_;
+    ThreadPool* pool_;
+    DecodeStats* stats_ = kDecodeStatsEnabled ? options_.stats : nullptr;
+    // Progressive scans, baseline ones count per restart interval in scan_.
+    BlockCounters counters_;
+    std::chrono::steady_clock::time_point deadline_;
+    // Entropy-coded bytes of the progressive scans decoded so far.
+    size_t scan_bytes_ = 0;
+    bool count_output_ = false;
+
+    std::optional<Frame> frame_;
+    std::optional<Scan> scan_;
+    std::optional<Coefficients> coefficients_;
+    size_t scans_ = 0;
+    int band_ = 1;
+    size_t last_mcu_ = 0;
+    // First MCU row not decoded yet.
+    int next_row_ = 0;
+    // The MCU row before next_row_ is reconstructed but not converted yet.
+    bool has_waiting_ = false;
+    size_t rows_done_ = 0;
+
+    bool done_reading_ = false;
+    bool begun_ = false;
+    bool finished_ = false;
+    ImageHeader header_;
+};
+
+ImageHeader DecodeRows(std::span<const uint8_t> data, RowSink& sink,
+                       const DecodeOptions& options) {
+    DecodeState state(sink, options, false);
+    state.Pump(data, true);
+    return state.Header();
+}
+
+class IncrementalDecoder::Impl {
+public:
+    Impl(RowSink& sink, const DecodeOptions& options)
+        : buffer_(DecodeState::Scratch(options, own_scratch_).buffer), options_(options) {
+        buffer_.clear();
+        // The state shares the scratch, whoever created it.
+        options_.scratch = options.scratch ? options.scratch : own_scratch_.get();
+        state_.emplace(sink, options_, true);
+    }
+
+    bool Feed(std::span<const uint8_t> chunk) {
+        buffer_.insert(buffer_.end(), chunk.begin(), chunk.end());
+        return state_->Pump(buffer_, false);
+    }
+
+    void Finish() {
+        state_->Pump(buffer_, true);
+    }
+
+    const DecodeState& State() const {
+        return *state_;
+    }
+
+private:
+    std::unique_ptr<DecodeScratch> own_scratch_;
+    std::vector<uint8_t>& buffer_;
+    DecodeOptions options_;
+    std::optional<DecodeState> state_;
+};
+
+IncrementalDecoder::IncrementalDecoder(RowSink& sink, const DecodeOptions& options)
+    : impl_(new Impl(sink, options)) {
+}
+
+IncrementalDecoder::~IncrementalDecoder() = default;
+
+bool IncrementalDecoder::Feed(std::span<const uint8_t> chunk) {
+    return impl_->Feed(chunk);
+}
+
+void IncrementalDecoder::Finish() {
+    impl_->Finish();
+}
+
+size_t IncrementalDecoder::RowsDone() const {
+    return impl_->State().RowsDone();
+}
+
+const ImageHeader& IncrementalDecoder::Header() const {
+    return impl_->State().Header();
+}
+
+JpegInfo ProbeJpeg(std::span<const uint8_t> data) {
+    Jpeg jpeg;
+    Input input(data);
+
+    Reader reader(input, jpeg, ReadMode::kHeaderOnly);
+
+    while (reader.ReadField()) {
+    }
+
+    if (!jpeg.begin_.Exists()) {
+        throw std::invalid_argument("No begin");
+    }
+
+    if (!jpeg.info_.Exists()) {
+        throw std::invalid_argument("No image info");
+    }
+
+    JpegInfo info;
+    info.width = jpeg.info_.width_;
+    info.height = jpeg.info_.high_;
+    info.precision = jpeg.info_.precision_;
+    info.progressive = jpeg.info_.marker_ == 0xC2;
+    info.restart_interval = jpeg.restart_.mcus_;
+    for (const auto& chan : jpeg.sos_.channels_) {
+        info.components.push_back({chan.h, chan.v, chan.quant_identifier_});
+    }
+    if (jpeg.comment_.Exists()) {
+        info.comment = jpeg.comment_.text_;
+    }
+
+    return info;
+}
+
+JpegInfo ProbeJpeg(const uint8_t* data, size_t size) {
+    return ProbeJpeg(std::span<const uint8_t>(data, size));
+}
+
+// Reads all of |stream| into the buffer of options.scratch, which is set to |own| first if
+// the caller passed none.
+std::span<const uint8_t> ReadStream(std::istream& stream, DecodeOptions& options,
+                                    std::unique_ptr<DecodeScratch>& own) {
+    if (!options.scratch) {
+        own.reset(new DecodeScratch());
+        options.scratch = own.get();
+    }
+
+    // Chunked reads, the parser then works on contiguous memory.
+    constexpr size_t kChunk = 1 << 16;
+    auto& buffer = DecodeState::Scratch(options, own).buffer;
+    buffer.clear();
+    while (stream) {
+        size_t size = buffer.size();
+        buffer.resize(size + kChunk);
+        stream.read(reinterpret_cast<char*>(buffer.data() + size), kChunk);
+        buffer.resize(size + stream.gcount());
+    }
+    return buffer;
+}
+
+ImageHeader DecodeRows(std::istream& stream, RowSink& sink, const DecodeOptions& options) {
+    std::unique_ptr<DecodeScratch> own_scratch;
+    DecodeOptions stream_options = options;
+    auto data = ReadStream(stream, stream_options, own_scratch);
+    return DecodeRows(data, sink, stream_options);
+}
+
+Image Decode(std::span<const uint8_t> data, const DecodeOptions& options) {
+    Image image;
+    ImageSink sink(image);
+    DecodeState state(sink, options, false);
+    state.CountOutputImage();
+    state.Pump(data, true);
     return image;
 }
+
+Image Decode(const uint8_t* data, size_t size, const DecodeOptions& options) {
+    return Decode(std::span<const uint8_t>(data, size), options);
+}
+
+Image Decode(std::istream& stream, const DecodeOptions& options) {
+    std::unique_ptr<DecodeScratch> own_scratch;
+    DecodeOptions stream_options = options;
+    auto data = ReadStream(stream, stream_options, own_scratch);
+    return Decode(data, stream_options);
+}
@@ -1,6 +1,209 @@
 #pragma once
 
 #include <image.h>
+#include <idct.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <istream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-Image Decode(std::istream& input);
+class ThreadPool;
+class DecodeScratch;
+
+// Rectangle of the output image in pixels.
+struct Crop {
+    size_t x = 0;
+    size_t y = 0;
+    size_t width = 0;
+    size_t height = 0;
+};
+
+enum class Upsampling {
+    // Every chroma sample is repeated over the pixels it covers.
+    kNearest,
+    // libjpeg's triangle filter ("fancy upsampling") for 2x horizontal and/or vertical
+    // subsampling, other factors and the DC-only 1/8 scale are replicated.
+    kFancy,
+};
+
+// "nearest" or "fancy", throws std::invalid_argument on other names.
+Upsampling ParseUpsampling(const std::string& name);
+
+// False when the library is built with JPEG_DECODER_STATS=OFF: none of the instrumentation
+// is compiled in then and DecodeOptions::stats is left untouched.
+#if defined(JPEG_DECODER_ENABLE_STATS)
+inline constexpr bool kDecodeStatsEnabled = true;
+#else
+inline constexpr bool kDecodeStatsEnabled = false;
+#endif
+
+// Where the time of one decode went and how much work it was, see DecodeOptions::stats.
+// Times are wall seconds. IDCT and color conversion run per MCU row, with several threads
+// their times add up the rows of all threads.
+struct DecodeStats {
+    // Markers and headers, and finding the end of every scan.
+    double parse_seconds = 0;
+    // Huffman decoding of the scans.
+    double entropy_seconds = 0;
+    // Dequantization and inverse DCT.
+    double idct_seconds = 0;
+    // Upsampling and color conversion.
+    double color_seconds = 0;
+    // The sink, i.e. PNG encoding and writing for JpegToPng.
+    double output_seconds = 0;
+    double total_seconds = 0;
+
+    // Entropy-coded bytes of all scans.
+    size_t bytes_scanned = 0;
+    // MCUs and blocks walked by the entropy decoder, progressive files count every scan.
+    size_t mcus = 0;
+    size_t blocks = 0;
+    size_t huffman_symbols = 0;
+    // Blocks ended by an end-of-block code (or inside an EOB run) before their last
+    // coefficient.
+    size_t eob_blocks = 0;
+    // Blocks reconstructed by the DC-only shortcut instead of an IDCT.
+    size_t dc_only_blocks = 0;
+    // Memory the decode state took from the arena, see DecodeScratch.
+    size_t peak_arena_bytes = 0;
+};
+
+// One JSON object with the fields of |stats| under their names.
+std::string DecodeStatsToJson(const DecodeStats& stats);
+
+// Caps on what one decode may cost, for files from untrusted sources. Zero (or null) means
+// no limit. The sizes are checked from the headers before anything is allocated for them.
+struct DecodeLimits {
+    // Pixels of the frame as the SOF declares it, before scaling and cropping. Checked as
+    // soon as the SOF is read.
+    size_t max_pixels = 0;
+    // Entropy-coded bytes of all scans together, checked as the scans arrive.
+    size_t max_scan_bytes = 0;
+    // Bytes of the decode buffers: the coefficients of progressive files, the MCU rows
+    // and, for Decode(), the output image.
+    size_t max_memory = 0;
+    // Wall time from the start of the decode (the construction of an IncrementalDecoder).
+    std::chrono::milliseconds timeout{0};
+    // Stops the decode once another thread sets it.
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+// Thrown when a decode exceeds its DecodeLimits, the timeout and cancel are checked between
+// MCU rows and scans. Derives from std::invalid_argument, like every decode error.
+class DecodeLimitError : public std::invalid_argument {
+public:
+    using std::invalid_argument::invalid_argument;
+};
+
+struct DecodeOptions {
+    IdctBackend idct = IdctBackend::kAuto;
+    // Decodes at 1/scale of the size (1, 2, 4 or 8) with 4x4, 2x2 and DC-only IDCTs instead of
+    // 8x8 ones, like libjpeg's jidctred. Sizes are rounded up.
+    size_t scale = 1;
+    // Decodes only this part of the (scaled) image when its width and height are set. Blocks
+    // outside of it are entropy-decoded without being stored, restart intervals before it
+    // are skipped entirely. Throws std::invalid_argument if it doesn't fit the image.
+    Crop crop;
+    // How subsampled chroma is brought to the full resolution.
+    Upsampling upsampling = Upsampling::kNearest;
+    // Threads working on one image, the calling one included. 0 uses every hardware thread.
+    // Restart intervals (DRI) are entropy-decoded in parallel, IDCT, upsampling and color
+    // conversion run in parallel over MCU rows.
+    size_t threads = 1;
+    // Used instead of a pool of |threads| created for every call when set.
+    ThreadPool* pool = nullptr;
+    // Buffers kept from the previous decode on the same scratch, saves the allocations when
+    // many images are decoded one after another.
+    DecodeScratch* scratch = nullptr;
+    // Filled in with the stats of the decode when set (and kDecodeStatsEnabled). Taking
+    // the times costs a few clock reads per MCU row.
+    DecodeStats* stats = nullptr;
+    DecodeLimits limits;
+};
+
+// Reads the whole stream into memory first, prefer the overloads taking bytes when the file
+// is already in memory or can be mapped (see MappedFile).
+Image Decode(std::istream& input, const DecodeOptions& options = {});
+
+// Decodes the file straight from |data|, nothing of it is copied.
+Image Decode(std::span<const uint8_t> data, const DecodeOptions& options = {});
+Image Decode(const uint8_t* data, size_t size, const DecodeOptions& options = {});
+
+// Streams the image to |sink| one MCU row at a time, so only O(width * MCU height) decoded
+// samples are held in memory. Returns the header that was passed to sink.Begin().
+ImageHeader DecodeRows(std::istream& input, RowSink& sink, const DecodeOptions& options = {});
+ImageHeader DecodeRows(std::span<const uint8_t> data, RowSink& sink,
+                       const DecodeOptions& options = {});
+
+// Decodes a file that arrives in chunks. Every MCU row goes to the sink as soon as its part
+// of the scan is complete, so the rows can be encoded while the rest of the file is still on
+// its way. Progressive files are emitted once their last scan is in. Malformed input throws
+// std::invalid_argument from Feed() or Finish().
+class IncrementalDecoder {
+public:
+    explicit IncrementalDecoder(RowSink& sink, const DecodeOptions& options = {});
+    ~IncrementalDecoder();
+
+    // Appends the next chunk of the file and decodes as far as the input so far allows.
+    // Returns true once the image is complete and sink.End() was called.
+    bool Feed(std::span<const uint8_t> chunk);
+
+    // Call after the last chunk, throws if the file is incomplete.
+    void Finish();
+
+    // Output rows passed to the sink so far.
+    size_t RowsDone() const;
+
+    // Filled in when sink.Begin() is called.
+    const ImageHeader& Header() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+struct JpegComponentInfo {
+    // Sampling factors.
+    size_t h = 1;
+    size_t v = 1;
+    size_t quant_table = 0;
+};
+
+// What the file headers say about the image, see ProbeJpeg.
+struct JpegInfo {
+    size_t width = 0;
+    size_t height = 0;
+    size_t precision = 8;
+    bool progressive = false;
+    // MCUs per restart interval, 0 without restart markers.
+    size_t restart_interval = 0;
+    std::vector<JpegComponentInfo> components;
+    // Only comments that come before the first scan.
+    std::string comment;
+};
+
+// Parses the headers up to the first SOS and stops there: no tables are built and none of
+// the scan is read, so the cost doesn't depend on the file size. Throws
+// std::invalid_argument if there is no SOI or no frame header before the scan.
+JpegInfo ProbeJpeg(std::span<const uint8_t> data);
+JpegInfo ProbeJpeg(const uint8_t* data, size_t size);
+
+// Parsed sections, the stream buffer, MCU row buffers and the arena holding the rest of the
+// decode state, reused by consecutive decodes. The buffers only grow. Not thread safe: every
+// thread decoding at the same time needs its own. JpegDecoder keeps one.
+class DecodeScratch {
+public:
+    DecodeScratch();
+    ~DecodeScratch();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+
+    friend class DecodeState;
+};
@@ -2,8 +2,69 @@
 #include <fftw3.h>
 #include <cmath>
 
+#include <map>
+#include <mutex>
 #include <stdexcept>
 
+namespace {
+
+// Everything in FFTW except fftw_execute* is not thread safe.
+std::mutex planner_mutex;
+
+class PlanCache {
+public:
+    struct Plan {
+        fftw_plan plan;
+        double* input;
+        double* output;
+    };
+
+    PlanCache() = default;
+
+    PlanCache(const PlanCache&) = delete;
+    PlanCache& operator=(const PlanCache&) = delete;
+
+    ~PlanCache() {
+        std::lock_guard<std::mutex> lock(planner_mutex);
+        for (auto& [width, plan] : plans_) {
+            fftw_destroy_plan(plan.plan);
+            fftw_free(plan.input);
+            fftw_free(plan.output);
+        }
+    }
+
+    const Plan& Get(size_t width) {
+        auto it = plans_.find(width);
+        if (it != plans_.end()) {
+            return it->second;
+        }
+
+        std::lock_guard<std::mutex> lock(planner_mutex);
+        Plan plan;
+        // fftw_malloc keeps the buffers aligned for the SIMD codelets.
+        plan.input = static_cast<double*>(fftw_malloc(sizeof(double) * width * width));
+        plan.output = static_cast<double*>(fftw_malloc(sizeof(double) * width * width));
+        if (!plan.input || !plan.output) {
+            fftw_free(plan.input);
+            fftw_free(plan.output);
+            throw std::bad_alloc();
+        }
+        plan.plan = fftw_plan_r2r_2d(width, width, plan.input, plan.output, FFTW_REDFT01,
+                                     FFTW_REDFT01, FFTW_MEASURE);
+        if (!plan.plan) {
+            fftw_free(plan.input);
+            fftw_free(plan.output);
+            throw std::runtime_error("FFTW planning failed");
+        }
+        return plans_.emplace(width, plan).first->second;
+    }
+
+private:
+    std::map<size_t, Plan> plans_;
+};
+
+}  // namespace
+
 class DctCalculator::Impl {
 public:
     using ValType = double;
@@ -27,27 +88,29 @@ public:
     }
 
     void Inverse() {
-        fftw_plan p;
         static const ValType kRowFactor = sqrt(2);
         static const ValType kAllFactor = 16;
+        thread_local PlanCache cache;
+
+        const auto& plan = cache.Get(width_);
+
+        for (size_t i = 0; i < width_ * width_; ++i) {
+            plan.input[i] = (*input_)[i];
+        }
 
         for (size_t x = 0; x < width_; ++x) {
-            (*input_)[x] *= kRowFactor;
+            plan.input[x] *= kRowFactor;
         }
 
         for (size_t y = 0; y < width_; ++y) {
-            (*input_)[y * width_] *= kRowFactor;
+            plan.input[y * width_] *= kRowFactor;
         }
 
-        p = fftw_plan_r2r_2d(width_, width_, input_->data(), output_->data(), FFTW_REDFT01,
-                             FFTW_REDFT01, FFTW_ESTIMATE);
-        fftw_execute(p);
+        fftw_execute_r2r(plan.plan, plan.input, plan.output);
 
         for (size_t i = 0; i < width_ * width_; ++i) {
-            (*output_)[i] /= kAllFactor;
+            (*output_)[i] = plan.output[i] / kAllFactor;
         }
-
-        fftw_destroy_plan(p);
     }
 
 private:
@@ -65,3 +128,13 @@ void DctCalculator::Inverse() {
 }
 
 DctCalculator::~DctCalculator() = default;
+
+bool LoadFftwWisdom(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    return fftw_import_wisdom_from_filename(filename.c_str());
+}
+
+bool SaveFftwWisdom(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    return fftw_export_wisdom_to_filename(filename.c_str());
+}
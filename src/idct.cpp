@@ -0,0 +1,376 @@
+#include <idct.h>
+#include <idct_aan.h>
+#include <idct_fixed.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+#if defined(JPEG_DECODER_HAVE_FFTW)
+#include "fft.h"
+#endif
+
+namespace {
+
+// Zigzag indices 0-9 are the ones inside the top-left 4x4 coefficients.
+constexpr int kQuarterLast = 10;
+
+uint8_t ClampSample(int32_t value) {
+    return static_cast<uint8_t>(std::max(0, std::min(255, value)));
+}
+
+// One Loeffler 1-D IDCT over in[0], in[step], ..., in[7 * step]. Inputs from |kInputs| on
+// are known to be zero, they are not read and their terms fold away at compile time.
+template <int kInputs = 8, class T>
+void LoefflerPass(const T* in, int step, int32_t out[8], int descale) {
+    auto at = [&](int i) -> int32_t { return i < kInputs ? in[i * step] : 0; };
+
+    int32_t z2 = at(2);
+    int32_t z3 = at(6);
+    int32_t z1 = (z2 + z3) * kFix0541196100;
+    int32_t tmp2 = z1 - z3 * kFix1847759065;
+    int32_t tmp3 = z1 + z2 * kFix0765366865;
+
+    z2 = at(0);
+    z3 = at(4);
+    int32_t tmp0 = (z2 + z3) * (1 << kConstBits);
+    int32_t tmp1 = (z2 - z3) * (1 << kConstBits);
+
+    int32_t tmp10 = tmp0 + tmp3;
+    int32_t tmp13 = tmp0 - tmp3;
+    int32_t tmp11 = tmp1 + tmp2;
+    int32_t tmp12 = tmp1 - tmp2;
+
+    tmp0 = at(7);
+    tmp1 = at(5);
+    tmp2 = at(3);
+    tmp3 = at(1);
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int32_t z4 = tmp1 + tmp3;
+    int32_t z5 = (z3 + z4) * kFix1175875602;
+
+    tmp0 *= kFix0298631336;
+    tmp1 *= kFix2053119869;
+    tmp2 *= kFix3072711026;
+    tmp3 *= kFix1501321110;
+    z1 *= -kFix0899976223;
+    z2 *= -kFix2562915447;
+    z3 = z3 * -kFix1961570560 + z5;
+    z4 = z4 * -kFix0390180644 + z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    out[0] = Descale(tmp10 + tmp3, descale);
+    out[7] = Descale(tmp10 - tmp3, descale);
+    out[1] = Descale(tmp11 + tmp2, descale);
+    out[6] = Descale(tmp11 - tmp2, descale);
+    out[2] = Descale(tmp12 + tmp1, descale);
+    out[5] = Descale(tmp12 - tmp1, descale);
+    out[3] = Descale(tmp13 + tmp0, descale);
+    out[4] = Descale(tmp13 - tmp0, descale);
+}
+
+// Only the top-left |kInputs| x |kInputs| coefficients may be nonzero.
+template <int kInputs = 8>
+void IdctScalar(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    int32_t workspace[64];
+
+    // Columns first, keeping kPass1Bits of extra precision.
+    for (int x = 0; x < 8; ++x) {
+        const int32_t* col = coeffs + x;
+        bool ac_zero = true;
+        for (int y = 1; y < kInputs && ac_zero; ++y) {
+            ac_zero = col[8 * y] == 0;
+        }
+
+        int32_t out[8];
+        if (x >= kInputs) {
+            std::fill(out, out + 8, 0);
+        } else if (ac_zero) {
+            std::fill(out, out + 8, col[0] * (1 << kPass1Bits));
+        } else {
+            LoefflerPass<kInputs>(col, 8, out, kConstBits - kPass1Bits);
+        }
+        for (int y = 0; y < 8; ++y) {
+            workspace[8 * y + x] = out[y];
+        }
+    }
+
+    // Rows, removing the pass 1 scaling and the 1/8 normalization.
+    for (int y = 0; y < 8; ++y) {
+        int32_t out[8];
+        LoefflerPass<kInputs>(workspace + 8 * y, 1, out, kConstBits + kPass1Bits + 3);
+        for (int x = 0; x < 8; ++x) {
+            output[y * stride + x] = ClampSample(out[x] + 128);
+        }
+    }
+}
+
+// Whether the |kSize|-point pass of libjpeg's jidctred reads input |i|: the 4-point one
+// needs every input but 4, the 2-point one the DC and the odd ones. The others cancel out
+// at the merged sample positions.
+template <int kSize>
+constexpr bool ReducedReads(int i) {
+    return kSize == 4 ? i != 4 : i == 0 || i % 2 == 1;
+}
+
+// libjpeg's jpeg_idct_4x4 and jpeg_idct_2x2. Columns whose AC inputs are zero and rows
+// whose AC terms are zero are a fill, like the full transform's.
+template <int kSize>
+void IdctReducedBlock(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    // The pass over kSize points scales by 8 / kSize more than the 8-point one.
+    constexpr int kExtraBits = kSize == 4 ? 1 : 2;
+    int32_t workspace[8 * kSize];
+
+    // Columns first, keeping kPass1Bits of extra precision.
+    for (int x = 0; x < 8; ++x) {
+        if (!ReducedReads<kSize>(x)) {
+            continue;
+        }
+        const int32_t* col = coeffs + x;
+        int32_t ac = 0;
+        for (int y = 1; y < 8; ++y) {
+            ac |= ReducedReads<kSize>(y) ? col[8 * y] : 0;
+        }
+
+        int32_t out[kSize];
+        if (ac == 0) {
+            std::fill(out, out + kSize, col[0] * (1 << kPass1Bits));
+        } else {
+            ReducedPass<kSize>(col, 8, out, kConstBits - kPass1Bits + kExtraBits);
+        }
+        for (int y = 0; y < kSize; ++y) {
+            workspace[8 * y + x] = out[y];
+        }
+    }
+
+    // Rows, removing the pass 1 scaling and the 1/8 normalization.
+    for (int y = 0; y < kSize; ++y) {
+        const int32_t* row = workspace + 8 * y;
+        int32_t ac = 0;
+        for (int x = 1; x < 8; ++x) {
+            ac |= ReducedReads<kSize>(x) ? row[x] : 0;
+        }
+
+        int32_t out[kSize];
+        if (ac == 0) {
+            std::fill(out, out + kSize, Descale(row[0], kPass1Bits + 3));
+        } else {
+            ReducedPass<kSize>(row, 1, out, kConstBits + kPass1Bits + 3 + kExtraBits);
+        }
+        for (int x = 0; x < kSize; ++x) {
+            output[y * stride + x] = ClampSample(out[x] + 128);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Eight float lanes as a pair of SSE registers.
+struct Sse2Lanes {
+    __m128 lo;
+    __m128 hi;
+
+    static Sse2Lanes Set(float value) {
+        return {_mm_set1_ps(value), _mm_set1_ps(value)};
+    }
+
+    static Sse2Lanes LoadInt(const int32_t* data) {
+        const __m128i* ptr = reinterpret_cast<const __m128i*>(data);
+        return {_mm_cvtepi32_ps(_mm_loadu_si128(ptr)), _mm_cvtepi32_ps(_mm_loadu_si128(ptr + 1))};
+    }
+
+    static Sse2Lanes LoadFloat(const float* data) {
+        return {_mm_loadu_ps(data), _mm_loadu_ps(data + 4)};
+    }
+
+    static void StoreSamples(Sse2Lanes value, uint8_t* output) {
+        __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(value.lo), _mm_cvtps_epi32(value.hi));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(output), _mm_packus_epi16(words, words));
+    }
+
+    static void Transpose(Sse2Lanes v[8]) {
+        _MM_TRANSPOSE4_PS(v[0].lo, v[1].lo, v[2].lo, v[3].lo);
+        _MM_TRANSPOSE4_PS(v[0].hi, v[1].hi, v[2].hi, v[3].hi);
+        _MM_TRANSPOSE4_PS(v[4].lo, v[5].lo, v[6].lo, v[7].lo);
+        _MM_TRANSPOSE4_PS(v[4].hi, v[5].hi, v[6].hi, v[7].hi);
+        for (int i = 0; i < 4; ++i) {
+            std::swap(v[i].hi, v[i + 4].lo);
+        }
+    }
+
+    Sse2Lanes operator+(Sse2Lanes other) const {
+        return {_mm_add_ps(lo, other.lo), _mm_add_ps(hi, other.hi)};
+    }
+
+    Sse2Lanes operator-(Sse2Lanes other) const {
+        return {_mm_sub_ps(lo, other.lo), _mm_sub_ps(hi, other.hi)};
+    }
+
+    Sse2Lanes operator*(Sse2Lanes other) const {
+        return {_mm_mul_ps(lo, other.lo), _mm_mul_ps(hi, other.hi)};
+    }
+};
+
+void IdctSse2(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    AanIdct<Sse2Lanes>(coeffs, output, stride);
+}
+#endif
+
+#if defined(JPEG_DECODER_HAVE_FFTW)
+void IdctFftw(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    thread_local std::vector<double> input(64);
+    thread_local std::vector<double> result(64);
+    for (size_t i = 0; i < 64; ++i) {
+        input[i] = static_cast<double>(coeffs[i]);
+    }
+
+    DctCalculator calc(8, &input, &result);
+    calc.Inverse();
+
+    for (size_t y = 0; y < 8; ++y) {
+        for (size_t x = 0; x < 8; ++x) {
+            output[y * stride + x] = ClampSample(std::lround(result[y * 8 + x] + 128));
+        }
+    }
+}
+#endif
+
+Idct::Function GetFunction(IdctBackend backend) {
+    switch (backend) {
+        case IdctBackend::kScalar:
+            return IdctScalar<>;
+#if defined(__SSE2__)
+        case IdctBackend::kSse2:
+            return IdctSse2;
+#endif
+#if defined(JPEG_DECODER_HAVE_AVX2)
+        case IdctBackend::kAvx2:
+            return IdctAvx2;
+#endif
+#if defined(JPEG_DECODER_HAVE_FFTW)
+        case IdctBackend::kFftw:
+            return IdctFftw;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+}  // namespace
+
+Idct::Idct(IdctBackend backend) {
+    backend_ = backend == IdctBackend::kAuto ? Detect() : backend;
+    if (!IsSupported(backend_)) {
+        throw std::invalid_argument(std::string("IDCT backend is not supported: ") +
+                                    IdctBackendName(backend_));
+    }
+    function_ = GetFunction(backend_);
+#if defined(JPEG_DECODER_HAVE_AVX2)
+    if (backend_ == IdctBackend::kAvx2) {
+        reduced4_function_ = IdctReduced4Avx2;
+        return;
+    }
+#endif
+    reduced4_function_ = IdctReducedBlock<4>;
+}
+
+void Idct::IdctReduced(const int32_t* coeffs, uint8_t* output, size_t stride, size_t size) {
+    if (size == 1) {
+        *output = ClampSample(Descale(coeffs[0], 3) + 128);
+    } else if (size == 2) {
+        IdctReducedBlock<2>(coeffs, output, stride);
+    } else if (size == 4) {
+        IdctReducedBlock<4>(coeffs, output, stride);
+    } else {
+        throw std::invalid_argument("Unsupported IDCT size");
+    }
+}
+
+void Idct::Inverse(const int32_t* coeffs, uint8_t* output, size_t stride, size_t size,
+                   int last) const {
+    if (backend_ == IdctBackend::kFftw) {
+        Inverse(coeffs, output, stride, size);
+    } else if (last == 0) {
+        // Every sample is the DC level, as the full transform would give it.
+        uint8_t value = ClampSample(Descale(coeffs[0], 3) + 128);
+        if (size == 8) {
+            uint64_t row = value * 0x0101010101010101ull;
+            for (size_t y = 0; y < 8; ++y) {
+                std::memcpy(output + y * stride, &row, 8);
+            }
+        } else {
+            for (size_t y = 0; y < size; ++y) {
+                std::memset(output + y * stride, value, size);
+            }
+        }
+    } else if (backend_ == IdctBackend::kScalar && size == 8 && last < kQuarterLast) {
+        // The vector backends transform a whole block faster than this skips.
+        IdctScalar<4>(coeffs, output, stride);
+    } else {
+        Inverse(coeffs, output, stride, size);
+    }
+}
+
+IdctBackend Idct::Detect() {
+    static const IdctBackend kDetected = [] {
+        for (auto backend : {IdctBackend::kAvx2, IdctBackend::kSse2}) {
+            if (IsSupported(backend)) {
+                return backend;
+            }
+        }
+        return IdctBackend::kScalar;
+    }();
+    return kDetected;
+}
+
+bool Idct::IsSupported(IdctBackend backend) {
+    if (!GetFunction(backend)) {
+        return false;
+    }
+#if defined(JPEG_DECODER_HAVE_AVX2)
+    if (backend == IdctBackend::kAvx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+const char* IdctBackendName(IdctBackend backend) {
+    switch (backend) {
+        case IdctBackend::kAuto:
+            return "auto";
+        case IdctBackend::kScalar:
+            return "scalar";
+        case IdctBackend::kSse2:
+            return "sse2";
+        case IdctBackend::kAvx2:
+            return "avx2";
+        case IdctBackend::kFftw:
+            return "fftw";
+    }
+    return "unknown";
+}
+
+IdctBackend ParseIdctBackend(const char* name) {
+    for (auto backend : {IdctBackend::kAuto, IdctBackend::kScalar, IdctBackend::kSse2,
+                         IdctBackend::kAvx2, IdctBackend::kFftw}) {
+        if (std::strcmp(name, IdctBackendName(backend)) == 0) {
+            return backend;
+        }
+    }
+    throw std::invalid_argument(std::string("Unknown IDCT backend: ") + name);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class IdctBackend {
+    // Picks the fastest backend the CPU supports.
+    kAuto,
+    // Separable Loeffler fixed-point kernel (13 bit constants, libjpeg "islow" layout).
+    kScalar,
+    // AAN float kernel, 4 lanes at a time.
+    kSse2,
+    // AAN float kernel, 8 lanes at a time.
+    kAvx2,
+    // Double precision FFTW REDFT01, kept as the accuracy reference.
+    kFftw,
+};
+
+// 8x8 inverse DCT with level shift and clamping. |coeffs| are 64 dequantized coefficients
+// in natural (row-major) order, the samples are written to |output| row by row with |stride|
+// bytes between rows.
+//
+// Every backend stays within +-1 of the kFftw output for each sample.
+class Idct {
+public:
+    using Function = void (*)(const int32_t* coeffs, uint8_t* output, size_t stride);
+
+    explicit Idct(IdctBackend backend = IdctBackend::kAuto);
+
+    void Inverse(const int32_t* coeffs, uint8_t* output, size_t stride) const {
+        function_(coeffs, output, stride);
+    }
+
+    // Reduced transform for scaled decoding: |size| x |size| samples (8, 4, 2 or 1) that are
+    // close to the box-downsampled full block. Sizes below 8 use IdctReduced, size 4 with
+    // kAvx2 an AVX2 version of it with the same output.
+    void Inverse(const int32_t* coeffs, uint8_t* output, size_t stride, size_t size) const {
+        if (size == 8) {
+            function_(coeffs, output, stride);
+        } else if (size == 4) {
+            reduced4_function_(coeffs, output, stride);
+        } else {
+            IdctReduced(coeffs, output, stride, size);
+        }
+    }
+
+    // Inverse() for a block without nonzero coefficients after zigzag index |last|, which the
+    // entropy decoder knows for free. DC-only blocks are a fill, blocks within the zigzag
+    // indices of the top-left 4x4 (|last| < 10) skip the zeros in a scalar kernel. kFftw
+    // always runs the full transform.
+    void Inverse(const int32_t* coeffs, uint8_t* output, size_t stride, size_t size,
+                 int last) const;
+
+    // libjpeg's jidctred kernels: the fixed-point 8-point IDCT evaluated at |size| sample
+    // positions per direction, reading only the coefficients that don't cancel out there
+    // (all but row and column 4 for size 4, the DC and odd ones for size 2). Size 1 is the
+    // block average from the DC coefficient alone.
+    static void IdctReduced(const int32_t* coeffs, uint8_t* output, size_t stride, size_t size);
+
+    IdctBackend Backend() const {
+        return backend_;
+    }
+
+    // Fastest backend available on this CPU and in this build.
+    static IdctBackend Detect();
+
+    // False if |backend| is not compiled in or not supported by the CPU.
+    static bool IsSupported(IdctBackend backend);
+
+private:
+    IdctBackend backend_;
+    Function function_;
+    Function reduced4_function_;
+};
+
+const char* IdctBackendName(IdctBackend backend);
+
+// Inverse of IdctBackendName, throws std::invalid_argument on unknown names.
+IdctBackend ParseIdctBackend(const char* name);
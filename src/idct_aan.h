@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Arai-Agui-Nakajima float IDCT shared by the vectorized backends. V is an 8-lane float
+// vector with +, -, *, and the static members Set, LoadInt, LoadFloat, StoreSamples and
+// Transpose. Each pass runs the 1-D transform on all eight columns at once.
+
+// cos(k * pi / 16) * sqrt(2), k > 0, the AAN prescale of coefficient row/column k.
+alignas(32) constexpr float kAanScale[8] = {1.0f,         1.387039845f, 1.306562965f,
+                                            1.175875602f, 1.0f,         0.785694958f,
+                                            0.541196100f, 0.275899379f};
+
+template <class V>
+void AanPass(V v[8]) {
+    V tmp10 = v[0] + v[4];
+    V tmp11 = v[0] - v[4];
+    V tmp13 = v[2] + v[6];
+    V tmp12 = (v[2] - v[6]) * V::Set(1.414213562f) - tmp13;
+
+    V tmp0 = tmp10 + tmp13;
+    V tmp3 = tmp10 - tmp13;
+    V tmp1 = tmp11 + tmp12;
+    V tmp2 = tmp11 - tmp12;
+
+    V z13 = v[5] + v[3];
+    V z10 = v[5] - v[3];
+    V z11 = v[1] + v[7];
+    V z12 = v[1] - v[7];
+
+    V tmp7 = z11 + z13;
+    V odd11 = (z11 - z13) * V::Set(1.414213562f);
+    V z5 = (z10 + z12) * V::Set(1.847759065f);
+    V odd10 = z5 - z12 * V::Set(1.082392200f);
+    V odd12 = z5 - z10 * V::Set(2.613125930f);
+
+    V tmp6 = odd12 - tmp7;
+    V tmp5 = odd11 - tmp6;
+    V tmp4 = odd10 - tmp5;
+
+    v[0] = tmp0 + tmp7;
+    v[7] = tmp0 - tmp7;
+    v[1] = tmp1 + tmp6;
+    v[6] = tmp1 - tmp6;
+    v[2] = tmp2 + tmp5;
+    v[5] = tmp2 - tmp5;
+    v[3] = tmp3 + tmp4;
+    v[4] = tmp3 - tmp4;
+}
+
+template <class V>
+void AanIdct(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    V v[8];
+    V col_scale = V::LoadFloat(kAanScale);
+    for (int i = 0; i < 8; ++i) {
+        // The 1/8 normalization of the 2-D transform is folded into the prescale.
+        v[i] = V::LoadInt(coeffs + 8 * i) * (col_scale * V::Set(kAanScale[i] * 0.125f));
+    }
+
+    AanPass(v);
+    V::Transpose(v);
+    AanPass(v);
+    V::Transpose(v);
+
+    V shift = V::Set(128.0f);
+    for (int i = 0; i < 8; ++i) {
+        V::StoreSamples(v[i] + shift, output + i * stride);
+    }
+}
+
+#if defined(JPEG_DECODER_HAVE_AVX2)
+void IdctAvx2(const int32_t* coeffs, uint8_t* output, size_t stride);
+#endif
@@ -0,0 +1,163 @@
+// Built with -mavx2, only called after a runtime CPU check.
+
+#include <idct_aan.h>
+#include <idct_fixed.h>
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace {
+
+struct Avx2Lanes {
+    __m256 value;
+
+    static Avx2Lanes Set(float value) {
+        return {_mm256_set1_ps(value)};
+    }
+
+    static Avx2Lanes LoadInt(const int32_t* data) {
+        return {_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)))};
+    }
+
+    static Avx2Lanes LoadFloat(const float* data) {
+        return {_mm256_loadu_ps(data)};
+    }
+
+    static void StoreSamples(Avx2Lanes lanes, uint8_t* output) {
+        __m256i ints = _mm256_cvtps_epi32(lanes.value);
+        __m128i words =
+            _mm_packs_epi32(_mm256_castsi256_si128(ints), _mm256_extracti128_si256(ints, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(output), _mm_packus_epi16(words, words));
+    }
+
+    static void Transpose(Avx2Lanes v[8]) {
+        __m256 t[8];
+        for (int i = 0; i < 4; ++i) {
+            t[2 * i] = _mm256_unpacklo_ps(v[2 * i].value, v[2 * i + 1].value);
+            t[2 * i + 1] = _mm256_unpackhi_ps(v[2 * i].value, v[2 * i + 1].value);
+        }
+        __m256 s[8];
+        for (int i = 0; i < 2; ++i) {
+            s[4 * i] = _mm256_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            s[4 * i + 1] = _mm256_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            s[4 * i + 2] = _mm256_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            s[4 * i + 3] = _mm256_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        for (int i = 0; i < 4; ++i) {
+            v[i].value = _mm256_permute2f128_ps(s[i], s[i + 4], 0x20);
+            v[i + 4].value = _mm256_permute2f128_ps(s[i], s[i + 4], 0x31);
+        }
+    }
+
+    Avx2Lanes operator+(Avx2Lanes other) const {
+        return {_mm256_add_ps(value, other.value)};
+    }
+
+    Avx2Lanes operator-(Avx2Lanes other) const {
+        return {_mm256_sub_ps(value, other.value)};
+    }
+
+    Avx2Lanes operator*(Avx2Lanes other) const {
+        return {_mm256_mul_ps(value, other.value)};
+    }
+};
+
+// 32-bit integer lanes for the jidctred passes: eight columns, then four rows at a time.
+struct Int32x8 {
+    __m256i value;
+
+    Int32x8 operator+(Int32x8 other) const {
+        return {_mm256_add_epi32(value, other.value)};
+    }
+
+    Int32x8 operator-(Int32x8 other) const {
+        return {_mm256_sub_epi32(value, other.value)};
+    }
+
+    Int32x8 operator*(int32_t factor) const {
+        return {_mm256_mullo_epi32(value, _mm256_set1_epi32(factor))};
+    }
+};
+
+Int32x8 Descale(Int32x8 lanes, int bits) {
+    __m256i rounded = _mm256_add_epi32(lanes.value, _mm256_set1_epi32(1 << (bits - 1)));
+    return {_mm256_srai_epi32(rounded, bits)};
+}
+
+struct Int32x4 {
+    __m128i value;
+
+    Int32x4 operator+(Int32x4 other) const {
+        return {_mm_add_epi32(value, other.value)};
+    }
+
+    Int32x4 operator-(Int32x4 other) const {
+        return {_mm_sub_epi32(value, other.value)};
+    }
+
+    Int32x4 operator*(int32_t factor) const {
+        return {_mm_mullo_epi32(value, _mm_set1_epi32(factor))};
+    }
+};
+
+Int32x4 Descale(Int32x4 lanes, int bits) {
+    __m128i rounded = _mm_add_epi32(lanes.value, _mm_set1_epi32(1 << (bits - 1)));
+    return {_mm_srai_epi32(rounded, bits)};
+}
+
+// Four rows of four lanes become four columns.
+void Transpose4(const __m128i rows[4], Int32x4 cols[4]) {
+    __m128i t0 = _mm_unpacklo_epi32(rows[0], rows[1]);
+    __m128i t1 = _mm_unpackhi_epi32(rows[0], rows[1]);
+    __m128i t2 = _mm_unpacklo_epi32(rows[2], rows[3]);
+    __m128i t3 = _mm_unpackhi_epi32(rows[2], rows[3]);
+    cols[0].value = _mm_unpacklo_epi64(t0, t2);
+    cols[1].value = _mm_unpackhi_epi64(t0, t2);
+    cols[2].value = _mm_unpacklo_epi64(t1, t3);
+    cols[3].value = _mm_unpackhi_epi64(t1, t3);
+}
+
+}  // namespace
+
+void IdctReduced4Avx2(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    // Columns: the rows of the block are the inputs, one column per lane.
+    Int32x8 rows[8];
+    for (int i = 0; i < 8; ++i) {
+        rows[i].value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coeffs + 8 * i));
+    }
+    Int32x8 workspace[4];
+    ReducedPass<4>(rows, 1, workspace, kConstBits - kPass1Bits + 1);
+
+    // Rows: the workspace transposed, one row per lane.
+    __m128i halves[2][4];
+    for (int y = 0; y < 4; ++y) {
+        halves[0][y] = _mm256_castsi256_si128(workspace[y].value);
+        halves[1][y] = _mm256_extracti128_si256(workspace[y].value, 1);
+    }
+    Int32x4 cols[8];
+    Transpose4(halves[0], cols);
+    Transpose4(halves[1], cols + 4);
+    Int32x4 out[4];
+    ReducedPass<4>(cols, 1, out, kConstBits + kPass1Bits + 3 + 1);
+
+    // out[x] holds sample x of each row: pack with saturation to 0-255, then reorder the
+    // bytes row by row.
+    __m128i shift = _mm_set1_epi32(128);
+    __m128i words0 = _mm_packs_epi32(_mm_add_epi32(out[0].value, shift),
+                                     _mm_add_epi32(out[1].value, shift));
+    __m128i words1 = _mm_packs_epi32(_mm_add_epi32(out[2].value, shift),
+                                     _mm_add_epi32(out[3].value, shift));
+    __m128i bytes = _mm_shuffle_epi8(_mm_packus_epi16(words0, words1),
+                                     _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3,
+                                                   7, 11, 15));
+    alignas(16) uint8_t samples[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(samples), bytes);
+    for (int y = 0; y < 4; ++y) {
+        std::memcpy(output + y * stride, samples + 4 * y, 4);
+    }
+}
+
+void IdctAvx2(const int32_t* coeffs, uint8_t* output, size_t stride) {
+    AanIdct<Avx2Lanes>(coeffs, output, stride);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-point IDCT arithmetic of libjpeg's jidctint and jidctred, shared by the scalar
+// kernels and the AVX2 reduced one, which gives the same samples.
+
+constexpr int kConstBits = 13;
+constexpr int kPass1Bits = 2;
+
+constexpr int32_t kFix0211164243 = 1730;
+constexpr int32_t kFix0298631336 = 2446;
+constexpr int32_t kFix0390180644 = 3196;
+constexpr int32_t kFix0509795579 = 4176;
+constexpr int32_t kFix0541196100 = 4433;
+constexpr int32_t kFix0601344887 = 4926;
+constexpr int32_t kFix0720959822 = 5906;
+constexpr int32_t kFix0765366865 = 6270;
+constexpr int32_t kFix0850430095 = 6967;
+constexpr int32_t kFix0899976223 = 7373;
+constexpr int32_t kFix1061594337 = 8697;
+constexpr int32_t kFix1175875602 = 9633;
+constexpr int32_t kFix1272758580 = 10426;
+constexpr int32_t kFix1451774981 = 11893;
+constexpr int32_t kFix1501321110 = 12299;
+constexpr int32_t kFix1847759065 = 15137;
+constexpr int32_t kFix1961570560 = 16069;
+constexpr int32_t kFix2053119869 = 16819;
+constexpr int32_t kFix2172734803 = 17799;
+constexpr int32_t kFix2562915447 = 20995;
+constexpr int32_t kFix3072711026 = 25172;
+constexpr int32_t kFix3624509785 = 29692;
+
+inline int32_t Descale(int32_t value, int bits) {
+    return (value + (1 << (bits - 1))) >> bits;
+}
+
+// One 1-D pass of jidctred over in[0], in[step], ..., in[7 * step]: the 8-point IDCT at the
+// |kSize| (4 or 2) positions between pairs or quadruples of full-size samples. V is int32_t
+// or a vector of 32-bit lanes with +, -, * by an int32_t and a Descale overload. Input 4, and
+// for size 2 inputs 2 and 6, cancel out and are not read.
+template <int kSize, class V>
+void ReducedPass(const V* in, int step, V out[kSize], int descale) {
+    auto at = [&](int i) { return in[i * step]; };
+    V z1 = at(7);
+    V z2 = at(5);
+    V z3 = at(3);
+    V z4 = at(1);
+
+    if constexpr (kSize == 4) {
+        V tmp0 = at(0) * (1 << (kConstBits + 1));
+        V tmp2 = at(2) * kFix1847759065 - at(6) * kFix0765366865;
+        V tmp10 = tmp0 + tmp2;
+        V tmp12 = tmp0 - tmp2;
+
+        tmp0 = z2 * kFix1451774981 + z4 * kFix1061594337 - z1 * kFix0211164243 -
+               z3 * kFix2172734803;
+        tmp2 = z3 * kFix0899976223 + z4 * kFix2562915447 - z1 * kFix0509795579 -
+               z2 * kFix0601344887;
+
+        out[0] = Descale(tmp10 + tmp2, descale);
+        out[3] = Descale(tmp10 - tmp2, descale);
+        out[1] = Descale(tmp12 + tmp0, descale);
+        out[2] = Descale(tmp12 - tmp0, descale);
+    } else {
+        V tmp10 = at(0) * (1 << (kConstBits + 2));
+        V tmp0 = z2 * kFix0850430095 + z4 * kFix3624509785 - z1 * kFix0720959822 -
+                 z3 * kFix1272758580;
+
+        out[0] = Descale(tmp10 + tmp0, descale);
+        out[1] = Descale(tmp10 - tmp0, descale);
+    }
+}
+
+#if defined(JPEG_DECODER_HAVE_AVX2)
+// The size 4 jidctred kernel on AVX2 lanes, sample for sample the scalar one.
+void IdctReduced4Avx2(const int32_t* coeffs, uint8_t* output, size_t stride);
+#endif
@@ -1,46 +1,153 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
 #include <string>
 
 struct RGB {
     int r, g, b;
 };
 
+enum class PixelFormat {
+    // Interleaved 8-bit R, G, B.
+    kRGB24,
+    // Interleaved 8-bit R, G, B, A.
+    kRGBA32,
+    // One 8-bit luma sample per pixel.
+    kGray8,
+    // Three full resolution 8-bit planes Y, Cb, Cr one after another.
+    kYCbCrPlanar,
+};
+
+// Bytes one pixel takes inside one plane.
+constexpr size_t BytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::kRGB24:
+            return 3;
+        case PixelFormat::kRGBA32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+constexpr size_t PlaneCount(PixelFormat format) {
+    return format == PixelFormat::kYCbCrPlanar ? 3 : 1;
+}
+
+// Contiguous 8-bit image. Rows of a plane are |Stride()| bytes apart, planes follow each
+// other in one allocation.
 class Image {
 public:
+    // Default row alignment, keeps every row start suitable for vector loads.
+    static constexpr size_t kRowAlignment = 32;
+
     Image() {
     }
-    Image(size_t width, size_t height) {
-        SetSize(width, height);
+    Image(size_t width, size_t height, PixelFormat format = PixelFormat::kRGB24) {
+        SetSize(width, height, format);
     }
 
-    void SetSize(size_t width, size_t height) {
-        data_.assign(height, std::vector<RGB>(width));
+    // |stride| of 0 picks the smallest multiple of kRowAlignment that fits a row.
+    void SetSize(size_t width, size_t height, PixelFormat format = PixelFormat::kRGB24,
+                 size_t stride = 0) {
+        size_t row_bytes = width * BytesPerPixel(format);
+        if (stride == 0) {
+            stride = (row_bytes + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+        }
+        if (stride < row_bytes) {
+            throw std::invalid_argument("Stride is shorter than a row");
+        }
+
+        width_ = width;
+        height_ = height;
+        format_ = format;
+        stride_ = stride;
+        data_.assign(stride_ * height_ * PlaneCount(format_), 0);
     }
 
     size_t Width() const {
-        if (data_.empty()) {
-            return 0;
-        }
-        return data_[0].size();
+        return width_;
     }
 
     size_t Height() const {
-        return data_.size();
+        return height_;
+    }
+
+    size_t Stride() const {
+        return stride_;
+    }
+
+    PixelFormat Format() const {
+        return format_;
+    }
+
+    // Bytes per pixel inside a plane.
+    size_t Channels() const {
+        return BytesPerPixel(format_);
+    }
+
+    size_t Planes() const {
+        return PlaneCount(format_);
+    }
+
+    uint8_t* Row(size_t y, size_t plane = 0) {
+        return data_.data() + (plane * height_ + y) * stride_;
+    }
+
+    const uint8_t* Row(size_t y, size_t plane = 0) const {
+        return data_.data() + (plane * height_ + y) * stride_;
+    }
+
+    // The pixels of row |y| without the stride padding.
+    std::span<uint8_t> RowSpan(size_t y, size_t plane = 0) {
+        return {Row(y, plane), width_ * Channels()};
+    }
+
+    std::span<const uint8_t> RowSpan(size_t y, size_t plane = 0) const {
+        return {Row(y, plane), width_ * Channels()};
     }
 
     void SetPixel(int y, int x, const RGB& pixel) {
-        data_[y][x] = pixel;
+        uint8_t r = Clamp(pixel.r), g = Clamp(pixel.g), b = Clamp(pixel.b);
+        uint8_t* ptr = Row(y) + x * Channels();
+        switch (format_) {
+            case PixelFormat::kRGBA32:
+                ptr[3] = 255;
+                [[fallthrough]];
+            case PixelFormat::kRGB24:
+                ptr[0] = r, ptr[1] = g, ptr[2] = b;
+                break;
+            case PixelFormat::kGray8:
+                *ptr = Luma(r, g, b);
+                break;
+            case PixelFormat::kYCbCrPlanar:
+                ptr[0] = Luma(r, g, b);
+                Row(y, 1)[x] = Clamp((-43 * r - 85 * g + 128 * b + 32896) >> 8);
+                Row(y, 2)[x] = Clamp((128 * r - 107 * g - 21 * b + 32896) >> 8);
+                break;
+        }
     }
 
     RGB GetPixel(int y, int x) const {
-        return data_[y][x];
-    }
+        const uint8_t* ptr = Row(y) + x * Channels();
+        switch (format_) {
+            case PixelFormat::kRGB24:
+            case PixelFormat::kRGBA32:
+                return {ptr[0], ptr[1], ptr[2]};
+            case PixelFormat::kGray8:
+                return {ptr[0], ptr[0], ptr[0]};
+            case PixelFormat::kYCbCrPlanar:
+                break;
+        }
 
-    RGB& GetPixel(int y, int x) {
-        return data_[y][x];
+        double luma = ptr[0], cb = Row(y, 1)[x] - 128.0, cr = Row(y, 2)[x] - 128.0;
+        return {Clamp(luma + 1.402 * cr + 0.5), Clamp(luma - 0.34414 * cb - 0.71414 * cr + 0.5),
+                Clamp(luma + 1.772 * cb + 0.5)};
     }
 
     void SetComment(const std::string& comment) {
@@ -52,6 +159,41 @@ public:
     }
 
 private:
-    std::vector<std::vector<RGB>> data_;
+    template <class T>
+    static uint8_t Clamp(T value) {
+        return static_cast<uint8_t>(std::max<T>(0, std::min<T>(value, 255)));
+    }
+
+    static uint8_t Luma(int r, int g, int b) {
+        return static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+
+    size_t width_ = 0;
+    size_t height_ = 0;
+    size_t stride_ = 0;
+    PixelFormat format_ = PixelFormat::kRGB24;
+    std::vector<uint8_t> data_;
     std::string comment_;
 };
+
+// Everything known about the decoded image before its first row.
+struct ImageHeader {
+    size_t width = 0;
+    size_t height = 0;
+    PixelFormat format = PixelFormat::kRGB24;
+    std::string comment;
+};
+
+// Receives an image row by row, top to bottom.
+class RowSink {
+public:
+    virtual ~RowSink() = default;
+
+    virtual void Begin(const ImageHeader& header) = 0;
+
+    // |row| holds header.width * BytesPerPixel(header.format) bytes.
+    virtual void WriteRow(size_t y, std::span<const uint8_t> row) = 0;
+
+    virtual void End() {
+    }
+};
@@ -1,44 +1,49 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <istream>
 
 using Byte = unsigned char;
 
-std::string ByteToStr(Byte byte) {
+inline std::string ByteToStr(Byte byte) {
     std::string s = "0123456789ABCDEF";
     return std::string(1, s[byte >> 4]) + std::string(1, s[byte & 15]);
 }
 
-size_t LeftByteHalf(Byte byte) {
+inline size_t LeftByteHalf(Byte byte) {
     return byte >> 4;
 }
 
-size_t RightByteHalf(Byte byte) {
+inline size_t RightByteHalf(Byte byte) {
     return byte & 15;
 }
 
-size_t Merge(Byte left, Byte right) {
+inline size_t Merge(Byte left, Byte right) {
     return (static_cast<size_t>(left) << 8) + static_cast<size_t>(right);
 }
 
-bool GetBit(Byte byte, int ind) {
+inline bool GetBit(Byte byte, int ind) {
     return (byte >> ind) & 1;
 }
 
+// Reads the file from contiguous memory. The bytes are not copied and have to outlive the
+// Input and everything parsed from it.
 class Input {
 public:
-    Input(std::istream* stream) {
-        stream_ = stream;
-        index_ = 0;
+    Input(const Byte* data, size_t size) : data_(data), size_(size) {
+    }
+
+    explicit Input(std::span<const Byte> data) : Input(data.data(), data.size()) {
     }
 
     bool operator>>(Byte& byte) {
-        byte = (*stream_).get();
-        if (!(*stream_).good()) {
+        if (index_ == size_) {
             return false;
         }
-        ++index_;
+        byte = data_[index_++];
         return true;
     }
 
@@ -63,8 +68,35 @@ public:
         return (static_cast<size_t>(l) << 8) + static_cast<size_t>(r);
     }
 
+    // The next |count| bytes, consumed.
+    std::span<const Byte> MustRead(size_t count) {
+        if (count > size_ - index_) {
+            throw std::invalid_argument("Input Ended");
+        }
+        std::span<const Byte> bytes(data_ + index_, count);
+        index_ += count;
+        return bytes;
+    }
+
+    // Everything that wasn't consumed yet.
+    std::span<const Byte> Rest() const {
+        return {data_ + index_, size_ - index_};
+    }
+
+    void Skip(size_t count) {
+        MustRead(count);
+    }
+
+    // Continues on a relocated and possibly longer copy of the same bytes, for input that
+    // arrives in chunks. The position is kept.
+    void Rebind(const Byte* data, size_t size) {
+        data_ = data;
+        size_ = size;
+    }
+
 private:
-    std::istream* stream_;
+    const Byte* data_;
+    size_t size_;
 
     size_t index_ = 0;
 };
@@ -1,12 +1,41 @@
 #pragma once
 
+#include <array>
 #include <istream>
+#include <span>
 #include <string>
 #include <vector>
 #include <cstdint>
 
 #include "huffman.h"
 
+constexpr size_t kMatrixSide = 8;
+constexpr size_t kMatrixSquare = kMatrixSide * kMatrixSide;
+// Components in one scan.
+constexpr size_t kMaxScanComponents = 4;
+
+// Natural (row-major) position of every zigzag index.
+constexpr std::array<uint8_t, kMatrixSquare> MakeZigzagToNatural() {
+    std::array<uint8_t, kMatrixSquare> table{};
+    int side = kMatrixSide;
+    size_t index = 0;
+    for (int sum = 0; sum < 2 * side - 1; ++sum) {
+        // Odd anti-diagonals run down from the top row, even ones up from the left column.
+        for (int step = 0; step < side; ++step) {
+            int row = sum % 2 ? step : side - 1 - step;
+            int col = sum - row;
+            if (col >= 0 && col < side) {
+                table[index++] = row * side + col;
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, kMatrixSquare> kZigzagToNatural = MakeZigzagToNatural();
+static_assert(kZigzagToNatural[1] == 1 && kZigzagToNatural[2] == 8 &&
+              kZigzagToNatural[kMatrixSquare - 1] == kMatrixSquare - 1);
+
 struct Field {
     bool Exists() const {
         return index_ != kNotExists;
@@ -38,9 +67,26 @@ struct QuantTable {
     size_t len_;
     size_t identifier_;
 
-    std::vector<size_t> data_;
+    // Quantizer of every coefficient in natural order, so that a coefficient decoded at
+    // zigzag index k goes to position kZigzagToNatural[k] multiplied by data_ there.
+    std::array<int32_t, kMatrixSquare> data_;
 };
 
+// Block of a progressive file, stored in zigzag order, to natural order times |quant|.
+// Returns the zigzag index of the last nonzero coefficient like the baseline path does.
+inline int DequantizeBlock(const int16_t* zigzag, const std::array<int32_t, kMatrixSquare>& quant,
+                           int32_t* natural) {
+    int last = 0;
+    for (size_t k = 0; k < kMatrixSquare; ++k) {
+        size_t pos = kZigzagToNatural[k];
+        natural[pos] = zigzag[k] * quant[pos];
+        if (zigzag[k]) {
+            last = k;
+        }
+    }
+    return last;
+}
+
 struct QuantTables : public Section {
     std::vector<QuantTable> tables_;
 
@@ -60,6 +106,11 @@ struct Dht {
 
     std::vector<uint8_t> codes_;
     std::vector<uint8_t> values_;
+    // False for placeholder slots below the highest table id and after Jpeg::Reset().
+    bool defined_ = false;
+    // tree_ is built from codes_ and values_. Survives Jpeg::Reset(), so the next image
+    // defining the same table doesn't build it again.
+    bool built_ = false;
 
     mutable HuffmanTree tree_;
 
@@ -72,17 +123,39 @@ struct Dhts : public Section {
 };
 
 struct ChannelInfo {
-    size_t identifier_;
+    size_t identifier_ = 0;
     // 0 - DC, 1 - AC
-    size_t table_id[2];
-    size_t h;
-    size_t v;
-    size_t quant_identifier_;
+    size_t table_id[2] = {0, 0};
+    size_t h = 0;
+    size_t v = 0;
+    size_t quant_identifier_ = 0;
 };
 
 struct Sos : public Section {
     std::vector<ChannelInfo> channels_;
-    std::vector<bool> data_;
+    // Entropy-coded data as stored in the file, still byte-stuffed. Points into the input
+    // buffer, which has to outlive the decode.
+    std::span<const uint8_t> data_;
+    // Offsets in data_ right after every RSTn marker, i.e. where each restart interval
+    // but the first one starts.
+    std::vector<size_t> restarts_;
+
+    // The scan header: components in scan order (indices into channels_), spectral
+    // selection and successive approximation. Baseline scans always have 0, 63, 0, 0.
+    std::vector<size_t> components_;
+    size_t ss_ = 0;
+    size_t se_ = 63;
+    size_t ah_ = 0;
+    size_t al_ = 0;
+    // Scans read so far. A progressive file has data_ and the fields above replaced by every
+    // one of them.
+    size_t scans_ = 0;
+    // Set while the input received so far ends inside the scan. data_ then holds the
+    // complete bytes up to there and checked_ of them have been searched for markers.
+    bool open_ = false;
+    size_t checked_ = 0;
+    // Input position of data_.
+    size_t offset_ = 0;
 
     void SetChannels(size_t channels) {
         if (channels == 0) {
@@ -99,7 +172,14 @@ struct Sos : public Section {
     }
 };
 
+struct RestartInterval : public Section {
+    // MCUs per restart interval, 0 if there are no restart markers.
+    size_t mcus_ = 0;
+};
+
 struct Information : public Section {
+    // The SOFn marker byte: 0xC0 baseline, 0xC1 extended sequential, 0xC2 progressive.
+    size_t marker_ = 0xC0;
     size_t precision_;
     size_t high_;
     size_t width_;
@@ -113,8 +193,37 @@ struct Jpeg {
     QuantTables tables_;
     Dhts huff_tables_;
     Information info_;
+    RestartInterval restart_;
     Sos sos_;
-};
 
-constexpr size_t kMatrixSide = 8;
-constexpr size_t kMatrixSquare = kMatrixSide * kMatrixSide;
\ No newline at end of file
+    // Forgets the previous image but keeps the Huffman tables and the other containers
+    // allocated, so decoding the next image into the same Jpeg doesn't allocate them again.
+    void Reset() {
+        std::vector<Dht> huffman[2] = {std::move(huff_tables_.data_[0]),
+                                       std::move(huff_tables_.data_[1])};
+        std::vector<QuantTable> quant = std::move(tables_.tables_);
+        std::string comment = std::move(comment_.text_);
+        std::vector<ChannelInfo> channels = std::move(sos_.channels_);
+        std::vector<size_t> restarts = std::move(sos_.restarts_);
+        std::vector<size_t> components = std::move(sos_.components_);
+
+        *this = Jpeg();
+
+        for (size_t i = 0; i < 2; ++i) {
+            for (auto& table : huffman[i]) {
+                table.defined_ = false;
+            }
+            huff_tables_.data_[i] = std::move(huffman[i]);
+        }
+        quant.clear();
+        tables_.tables_ = std::move(quant);
+        comment.clear();
+        comment_.text_ = std::move(comment);
+        channels.clear();
+        sos_.channels_ = std::move(channels);
+        restarts.clear();
+        sos_.restarts_ = std::move(restarts);
+        components.clear();
+        sos_.components_ = std::move(components);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <jpeg_decoder.h>
+#include <thread_pool.h>
+
+#include <mutex>
+#include <vector>
+
+class JpegDecoder::Impl {
+public:
+    explicit Impl(const DecodeOptions& options) : options_(options) {
+        options_.scratch = &scratch_;
+        if (!options_.pool && options_.threads != 1) {
+            pool_.reset(new ThreadPool(options_.threads));
+            options_.pool = pool_.get();
+        }
+    }
+
+    DecodeOptions options_;
+    DecodeScratch scratch_;
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+JpegDecoder::JpegDecoder(const DecodeOptions& options) : impl_(new Impl(options)) {
+}
+
+JpegDecoder::~JpegDecoder() = default;
+
+Image JpegDecoder::Decode(std::span<const uint8_t> data) {
+    return ::Decode(data, impl_->options_);
+}
+
+Image JpegDecoder::Decode(std::istream& input) {
+    return ::Decode(input, impl_->options_);
+}
+
+ImageHeader JpegDecoder::DecodeRows(std::span<const uint8_t> data, RowSink& sink) {
+    return ::DecodeRows(data, sink, impl_->options_);
+}
+
+ImageHeader JpegDecoder::DecodeRows(std::istream& input, RowSink& sink) {
+    return ::DecodeRows(input, sink, impl_->options_);
+}
+
+const DecodeOptions& JpegDecoder::Options() const {
+    return impl_->options_;
+}
+
+class JpegDecoderPool::Impl {
+public:
+    explicit Impl(const DecodeOptions& options) : options_(options) {
+        // Both would be used by several decodes at the same time.
+        options_.pool = nullptr;
+        options_.stats = nullptr;
+    }
+
+    // Runs |task| with a decoder no other thread uses meanwhile.
+    template <class Task>
+    auto With(const Task& task) {
+        std::unique_ptr<JpegDecoder> decoder;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (idle_.empty()) {
+                decoder.reset(new JpegDecoder(options_));
+                ++size_;
+            } else {
+                decoder = std::move(idle_.back());
+                idle_.pop_back();
+            }
+        }
+
+        // The decoder goes back even if the task throws, its scratch is reset by the next
+        // decode anyway.
+        struct Return {
+            ~Return() {
+                std::lock_guard<std::mutex> lock(impl.mutex_);
+                impl.idle_.push_back(std::move(decoder));
+            }
+
+            Impl& impl;
+            std::unique_ptr<JpegDecoder>& decoder;
+        } give_back{*this, decoder};
+        return task(*decoder);
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+private:
+    DecodeOptions options_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<JpegDecoder>> idle_;
+    size_t size_ = 0;
+};
+
+JpegDecoderPool::JpegDecoderPool(const DecodeOptions& options) : impl_(new Impl(options)) {
+}
+
+JpegDecoderPool::~JpegDecoderPool() = default;
+
+Image JpegDecoderPool::Decode(std::span<const uint8_t> data) {
+    return impl_->With([&](JpegDecoder& decoder) { return decoder.Decode(data); });
+}
+
+ImageHeader JpegDecoderPool::DecodeRows(std::span<const uint8_t> data, RowSink& sink) {
+    return impl_->With([&](JpegDecoder& decoder) { return decoder.DecodeRows(data, sink); });
+}
+
+size_t JpegDecoderPool::Size() const {
+    return impl_->Size();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <span>
+
+#include "decoder.h"
+
+// Decodes one image after another with the same options and keeps what a decode sets up
+// for the next one: the DecodeScratch (parsed sections, Huffman trees the next file defines
+// the same way, row and coefficient buffers, the arena) and, for options.threads != 1, the
+// ThreadPool. The buffers only grow, so after the first few images of a kind decoding
+// doesn't allocate. Not thread safe, see JpegDecoderPool.
+class JpegDecoder {
+public:
+    // options.scratch is ignored, the decoder has its own.
+    explicit JpegDecoder(const DecodeOptions& options = {});
+    ~JpegDecoder();
+
+    JpegDecoder(const JpegDecoder&) = delete;
+    JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+    Image Decode(std::span<const uint8_t> data);
+    Image Decode(std::istream& input);
+
+    ImageHeader DecodeRows(std::span<const uint8_t> data, RowSink& sink);
+    ImageHeader DecodeRows(std::istream& input, RowSink& sink);
+
+    const DecodeOptions& Options() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// JpegDecoders shared by any number of threads: every call borrows an idle decoder, or
+// creates one if all are busy, and gives it back afterwards. A long-running service thus
+// keeps one warm decoder per thread decoding at the same time. Thread safe.
+class JpegDecoderPool {
+public:
+    // options.pool and options.stats are ignored: every decoder gets its own pool for
+    // options.threads != 1 and nothing is shared between concurrent decodes.
+    explicit JpegDecoderPool(const DecodeOptions& options = {});
+    ~JpegDecoderPool();
+
+    Image Decode(std::span<const uint8_t> data);
+    ImageHeader DecodeRows(std::span<const uint8_t> data, RowSink& sink);
+
+    // Decoders created so far, the most calls that ran at the same time.
+    size_t Size() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -1,17 +1,13 @@
 #include <jpg_to_png.hpp>
 #include <decoder.h>
 #include <png_encoder.hpp>
+#include <mapped_file.h>
 
 void JpegToPng(const std::string& filename, std::string& comment,
-               const std::string& output_filename) {
+               const std::string& output_filename, const DecodeOptions& options,
+               const PngOptions& png_options) {
     std::cerr << "Running " << filename << "\n";
-    std::ifstream fin(filename);
-    if (!fin.is_open()) {
-        std::cerr << "Cannot open a file\n";
-        throw std::invalid_argument("Cannot open a file");
-    }
-    auto image = Decode(fin);
-    fin.close();
-    comment = image.GetComment();
-    WritePng(output_filename, image);
+    MappedFile file(filename);
+    PngWriter writer(output_filename, png_options);
+    comment = DecodeRows(file.Data(), writer, options).comment;
 }
\ No newline at end of file
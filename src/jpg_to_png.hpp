@@ -4,5 +4,9 @@
 #include <iostream>
 #include <fstream>
 
+#include "decoder.h"
+#include "png_encoder.hpp"
+
 void JpegToPng(const std::string& filename, std::string& comment,
-                const std::string& output_filename);
\ No newline at end of file
+                const std::string& output_filename, const DecodeOptions& options = {},
+                const PngOptions& png_options = {});
\ No newline at end of file
@@ -1,27 +1,166 @@
+#include <batch.h>
 #include <jpg_to_png.hpp>
+#if defined(JPEG_DECODER_HAVE_FFTW)
+#include <fft.h>
+#endif
 
+#include <cstdio>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <exception>
+#include <vector>
 
-int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cerr << "To few arguments\n";
-        return 0;
+// "WxH+X+Y", the X11 geometry format.
+Crop ParseCrop(const std::string& text) {
+    Crop crop;
+    char tail;
+    if (std::sscanf(text.c_str(), "%zux%zu+%zu+%zu%c", &crop.width, &crop.height, &crop.x,
+                    &crop.y, &tail) != 4) {
+        throw std::invalid_argument("Crop must look like WxH+X+Y: " + text);
     }
+    return crop;
+}
 
-    std::string input_filename = argv[1];
-    std::string output_filename = argv[2];
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
     std::string comment;
+    DecodeOptions options;
+    PngOptions png_options;
+    std::string wisdom_filename;
+    bool batch = false;
+    size_t jobs = 0;
+    std::string manifest_filename;
+    // Where --stats writes its JSON, "-" for stdout.
+    std::string stats_filename;
 
     try {
-        JpegToPng(input_filename, comment, output_filename);
-    } catch(std::exception& ex) {
-        std::cerr << "Failed to convert\n";
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                files.push_back(arg);
+            } else if (arg.rfind("--idct=", 0) == 0) {
+                options.idct = ParseIdctBackend(arg.c_str() + 7);
+            } else if (arg.rfind("--threads=", 0) == 0) {
+                options.threads = std::stoul(arg.substr(10));
+            } else if (arg.rfind("--png-level=", 0) == 0) {
+                png_options.compression_level = std::stoi(arg.substr(12));
+            } else if (arg.rfind("--png-filter=", 0) == 0) {
+                png_options.filter = ParsePngFilter(arg.substr(13));
+            } else if (arg.rfind("--fftw-wisdom=", 0) == 0) {
+                wisdom_filename = arg.substr(14);
+            } else if (arg.rfind("--scale=1/", 0) == 0) {
+                options.scale = std::stoul(arg.substr(10));
+            } else if (arg.rfind("--crop=", 0) == 0) {
+                options.crop = ParseCrop(arg.substr(7));
+            } else if (arg.rfind("--upsampling=", 0) == 0) {
+                options.upsampling = ParseUpsampling(arg.substr(13));
+            } else if (arg.rfind("--max-pixels=", 0) == 0) {
+                options.limits.max_pixels = std::stoull(arg.substr(13));
+            } else if (arg.rfind("--max-scan-bytes=", 0) == 0) {
+                options.limits.max_scan_bytes = std::stoull(arg.substr(17));
+            } else if (arg.rfind("--max-memory=", 0) == 0) {
+                options.limits.max_memory = std::stoull(arg.substr(13));
+            } else if (arg.rfind("--timeout=", 0) == 0) {
+                options.limits.timeout = std::chrono::milliseconds(std::stoul(arg.substr(10)));
+            } else if (arg == "--batch") {
+                batch = true;
+            } else if (arg.rfind("--jobs=", 0) == 0) {
+                jobs = std::stoul(arg.substr(7));
+            } else if (arg.rfind("--manifest=", 0) == 0) {
+                manifest_filename = arg.substr(11);
+            } else if (arg == "--stats") {
+                stats_filename = "-";
+            } else if (arg.rfind("--stats=", 0) == 0) {
+                stats_filename = arg.substr(8);
+            } else {
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (std::exception& ex) {
         std::cerr << ex.what() << '\n';
+        return batch ? 2 : 0;
+    }
+
+    if (!stats_filename.empty() && (batch || !kDecodeStatsEnabled)) {
+        std::cerr << (batch ? "--stats is not supported with --batch\n"
+                            : "Built without stats (JPEG_DECODER_STATS=OFF)\n");
+        return 2;
+    }
+
+    if (!batch && files.size() < 2) {
+        std::cerr << "To few arguments\n";
         return 0;
     }
 
-    std::cerr << "Successfully converted\nComment: " << comment << '\n';
-    return 0;
-}
\ No newline at end of file
+    std::vector<BatchJob> batch_jobs;
+    if (batch) {
+        if (files.size() % 2) {
+            std::cerr << "Batch mode takes input and output file pairs\n";
+            return 2;
+        }
+        for (size_t i = 0; i < files.size(); i += 2) {
+            batch_jobs.push_back({files[i], files[i + 1]});
+        }
+
+        try {
+            if (manifest_filename == "-" || (manifest_filename.empty() && files.empty())) {
+                auto listed = ReadManifest(std::cin);
+                batch_jobs.insert(batch_jobs.end(), listed.begin(), listed.end());
+            } else if (!manifest_filename.empty()) {
+                std::ifstream manifest(manifest_filename);
+                if (!manifest.is_open()) {
+                    throw std::invalid_argument("Cannot open " + manifest_filename);
+                }
+                auto listed = ReadManifest(manifest);
+                batch_jobs.insert(batch_jobs.end(), listed.begin(), listed.end());
+            }
+        } catch (std::exception& ex) {
+            std::cerr << ex.what() << '\n';
+            return 2;
+        }
+    }
+
+#if defined(JPEG_DECODER_HAVE_FFTW)
+    if (!wisdom_filename.empty()) {
+        LoadFftwWisdom(wisdom_filename);
+    }
+#endif
+
+    int result = 0;
+    if (batch) {
+        result = ConvertBatch(batch_jobs, jobs, options, png_options) ? 1 : 0;
+    } else {
+        DecodeStats stats;
+        if (!stats_filename.empty()) {
+            options.stats = &stats;
+        }
+        try {
+            JpegToPng(files[0], comment, files[1], options, png_options);
+        } catch (std::exception& ex) {
+            std::cerr << "Failed to convert\n";
+            std::cerr << ex.what() << '\n';
+            return 0;
+        }
+        std::cerr << "Successfully converted\nComment: " << comment << '\n';
+
+        if (stats_filename == "-") {
+            std::cout << DecodeStatsToJson(stats) << '\n';
+        } else if (!stats_filename.empty()) {
+            std::ofstream output(stats_filename);
+            output << DecodeStatsToJson(stats) << '\n';
+            if (!output) {
+                std::cerr << "Can't write stats to " << stats_filename << '\n';
+                result = 1;
+            }
+        }
+    }
+
+#if defined(JPEG_DECODER_HAVE_FFTW)
+    if (!wisdom_filename.empty() && !SaveFftwWisdom(wisdom_filename)) {
+        std::cerr << "Can't save FFTW wisdom to " << wisdom_filename << '\n';
+    }
+#endif
+
+    return result;
+}
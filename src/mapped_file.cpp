@@ -0,0 +1,56 @@
+#include <mapped_file.h>
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JPEG_DECODER_HAVE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string& filename) {
+#if defined(JPEG_DECODER_HAVE_MMAP)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::invalid_argument("Cannot open a file");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // The whole file is read front to back exactly once.
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const uint8_t*>(data);
+            size_ = info.st_size;
+            mapped_ = true;
+        }
+    }
+    close(fd);
+
+    if (mapped_) {
+        return;
+    }
+#endif
+
+    // Pipes, empty files and platforms without mmap.
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin.is_open()) {
+        throw std::invalid_argument("Cannot open a file");
+    }
+    buffer_.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+MappedFile::~MappedFile() {
+#if defined(JPEG_DECODER_HAVE_MMAP)
+    if (mapped_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+}
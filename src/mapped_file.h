@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Memory-mapped where the platform supports it, read into
+// a buffer otherwise. Throws std::invalid_argument if the file can't be opened.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    std::span<const uint8_t> Data() const {
+        return {data_, size_};
+    }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    // Holds the file when it isn't mapped.
+    std::vector<uint8_t> buffer_;
+};
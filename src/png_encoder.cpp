@@ -1,46 +1,156 @@
 #include "png_encoder.hpp"
 
-#include <png.h>
-
+#include <cstdio>
 #include <string>
 #include <stdexcept>
+#include <vector>
+
+namespace {
+
+int GetColorType(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::kGray8:
+            return PNG_COLOR_TYPE_GRAY;
+        case PixelFormat::kRGBA32:
+            return PNG_COLOR_TYPE_RGBA;
+        default:
+            return PNG_COLOR_TYPE_RGB;
+    }
+}
+
+int GetFilters(PngFilter filter) {
+    switch (filter) {
+        case PngFilter::kNone:
+            return PNG_FILTER_NONE;
+        case PngFilter::kSub:
+            return PNG_FILTER_SUB;
+        case PngFilter::kUp:
+            return PNG_FILTER_UP;
+        case PngFilter::kAverage:
+            return PNG_FILTER_AVG;
+        case PngFilter::kPaeth:
+            return PNG_FILTER_PAETH;
+        default:
+            return PNG_ALL_FILTERS;
+    }
+}
+
+// libpng's error callback: keeps the message for the throw after the longjmp back to the
+// setjmp of the PngWriter method that failed.
+void OnPngError(png_structp png, png_const_charp message) {
+    *static_cast<std::string*>(png_get_error_ptr(png)) = message;
+    png_longjmp(png, 1);
+}
+
+}  // namespace
+
+PngFilter ParsePngFilter(const std::string& name) {
+    static const std::pair<const char*, PngFilter> kNames[] = {
+        {"default", PngFilter::kDefault}, {"none", PngFilter::kNone},
+        {"sub", PngFilter::kSub},         {"up", PngFilter::kUp},
+        {"average", PngFilter::kAverage}, {"paeth", PngFilter::kPaeth},
+        {"all", PngFilter::kAll}};
+    for (const auto& [filter_name, filter] : kNames) {
+        if (name == filter_name) {
+            return filter;
+        }
+    }
+    throw std::invalid_argument("Unknown PNG filter: " + name);
+}
+
+PngWriter::PngWriter(const std::string& filename, const PngOptions& options)
+    : filename_(filename), options_(options) {
+}
+
+PngWriter::~PngWriter() {
+    Close();
+    // A writer destroyed before End() completed the image, or after libpng failed, holds a
+    // truncated file, don't leave it behind.
+    if (truncated_) {
+        std::remove(filename_.c_str());
+    }
+}
+
+void PngWriter::Close() {
+    if (png_) {
+        png_destroy_write_struct(&png_, &info_);
+    }
+    if (fp_) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+}
 
-void WritePng(const std::string& filename, const Image& image) {
-    FILE* fp = fopen(filename.c_str(), "wb");
-    if (!fp) {
-        throw std::runtime_error("Can't open file for writing " + filename);
+void PngWriter::Fail() {
+    Close();
+    throw std::runtime_error("Can't write " + filename_ + ": " + error_);
+}
+
+void PngWriter::Begin(const ImageHeader& header) {
+    fp_ = fopen(filename_.c_str(), "wb");
+    if (!fp_) {
+        throw std::runtime_error("Can't open file for writing " + filename_);
     }
-    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);  // NOLINT
-    png_infop info = png_create_info_struct(png);
-    if (setjmp(png_jmpbuf(png))) {
-        throw std::runtime_error("Shit happens");
+    truncated_ = true;
+    png_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, &error_, OnPngError, NULL);  // NOLINT
+    info_ = png_create_info_struct(png_);
+    if (setjmp(png_jmpbuf(png_))) {
+        Fail();
     }
 
-    png_init_io(png, fp);
+    png_init_io(png_, fp_);
 
-    png_set_IHDR(png, info, image.Width(), image.Height(), 8, PNG_COLOR_TYPE_RGBA,
+    if (options_.compression_level >= 0) {
+        png_set_compression_level(png_, options_.compression_level);
+    }
+    if (options_.filter != PngFilter::kDefault) {
+        png_set_filter(png_, PNG_FILTER_TYPE_BASE, GetFilters(options_.filter));
+    }
+
+    png_set_IHDR(png_, info_, header.width, header.height, 8, GetColorType(header.format),
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(png, info);
+    png_write_info(png_, info_);
+}
 
-    png_bytep* bytes = (png_bytep*)malloc(sizeof(png_bytep) * image.Height());  // NOLINT
+void PngWriter::WriteRow(size_t, std::span<const uint8_t> row) {
+    if (setjmp(png_jmpbuf(png_))) {
+        Fail();
+    }
+    // libpng doesn't modify the row, its API is just not const-correct.
+    png_write_row(png_, const_cast<png_bytep>(row.data()));
+}
+
+void PngWriter::End() {
+    if (setjmp(png_jmpbuf(png_))) {
+        Fail();
+    }
+    png_write_end(png_, NULL);  // NOLINT
+    Close();
+    truncated_ = false;
+}
+
+void WritePng(const std::string& filename, const Image& image, const PngOptions& options) {
+    bool planar = image.Format() == PixelFormat::kYCbCrPlanar;
+
+    PngWriter writer(filename, options);
+    writer.Begin({image.Width(), image.Height(),
+                  planar ? PixelFormat::kRGB24 : image.Format(), image.GetComment()});
+
+    std::vector<uint8_t> converted(planar ? image.Width() * 3 : 0);
     for (size_t y = 0; y < image.Height(); y++) {
-        bytes[y] = (png_byte*)malloc(png_get_rowbytes(png, info));  // NOLINT
+        if (!planar) {
+            writer.WriteRow(y, image.RowSpan(y));
+            continue;
+        }
+
         for (size_t x = 0; x < image.Width(); ++x) {
             auto pixel = image.GetPixel(y, x);
-            bytes[y][x * 4] = pixel.r;
-            bytes[y][x * 4 + 1] = pixel.g;
-            bytes[y][x * 4 + 2] = pixel.b;
-            bytes[y][x * 4 + 3] = 255;
+            converted[x * 3] = pixel.r;
+            converted[x * 3 + 1] = pixel.g;
+            converted[x * 3 + 2] = pixel.b;
         }
+        writer.WriteRow(y, converted);
     }
-    png_write_image(png, bytes);
-    png_write_end(png, NULL);  // NOLINT
 
-    fclose(fp);
-    png_destroy_write_struct(&png, &info);
-
-    for (size_t i = 0; i < image.Height(); ++i) {
-        free(bytes[i]);
-    }
-    free(bytes);
+    writer.End();
 }
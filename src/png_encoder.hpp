@@ -1,7 +1,64 @@
 #pragma once
 
+#include <png.h>
+
+#include <cstdio>
 #include <string>
 
 #include "image.h"
 
-void WritePng(const std::string& filename, const Image& image);
+enum class PngFilter {
+    // libpng's adaptive choice: all filters for color, none for palette images.
+    kDefault,
+    kNone,
+    kSub,
+    kUp,
+    kAverage,
+    kPaeth,
+    kAll,
+};
+
+struct PngOptions {
+    // zlib level 0-9, -1 keeps the zlib default (6). Low levels trade size for latency.
+    int compression_level = -1;
+    PngFilter filter = PngFilter::kDefault;
+};
+
+// Inverse of the lower case filter names ("none", "sub", "up", "average", "paeth", "all",
+// "default"), throws std::invalid_argument on unknown names.
+PngFilter ParsePngFilter(const std::string& name);
+
+// Streams rows to a PNG file as they are produced: Gray8 as gray, RGB24 as RGB, RGBA32
+// as RGBA. The file is opened in Begin() and completed in End().
+class PngWriter : public RowSink {
+public:
+    explicit PngWriter(const std::string& filename, const PngOptions& options = {});
+
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator=(const PngWriter&) = delete;
+
+    ~PngWriter() override;
+
+    void Begin(const ImageHeader& header) override;
+    void WriteRow(size_t y, std::span<const uint8_t> row) override;
+    void End() override;
+
+private:
+    void Close();
+    // Throws std::runtime_error with libpng's message after it longjmp-ed back.
+    [[noreturn]] void Fail();
+
+    std::string filename_;
+    PngOptions options_;
+
+    FILE* fp_ = nullptr;
+    png_structp png_ = nullptr;
+    png_infop info_ = nullptr;
+    // The file exists and End() hasn't completed it.
+    bool truncated_ = false;
+    // libpng's last error message.
+    std::string error_;
+};
+
+// Writes the rows of |image| as they are. Planar YCbCr is converted to RGB one row at a time.
+void WritePng(const std::string& filename, const Image& image, const PngOptions& options = {});
@@ -1,34 +1,18 @@
 #pragma once
 
-#include <memory>
-#include <map>
+#include <cstring>
+#include <array>
+#include <span>
 
 #include "jpeg.h"
 #include "input.h"
 
-class Marker {
-public:
-    Marker(Byte byte) {
-        byte_ = byte;
-    }
-
-    bool operator<(const Marker& anoth) const {
-        return byte_ < anoth.byte_;
-    }
-
-private:
-    Byte byte_;
-};
-
-class SectionReader;
-
-using SectionReaderPtr = std::unique_ptr<SectionReader>;
-
+// Reads one marker segment into the Jpeg. Readers are reused for every segment with their
+// marker, so they keep no state from one ReadField() to the next.
 class SectionReader {
 public:
     virtual ~SectionReader() = default;
     virtual bool ReadField(Input& input, Jpeg& jpeg) = 0;
-    virtual SectionReaderPtr Copy() = 0;
 };
 
 class BeginSection : public SectionReader {
@@ -38,10 +22,6 @@ public:
 
         return true;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new BeginSection());
-    }
 };
 
 class EndSection : public SectionReader {
@@ -50,21 +30,18 @@ public:
         jpeg.end_.SetIndex(input.Index());
         return false;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new EndSection());
-    }
 };
 
 class BlockSection : public SectionReader {
 protected:
     void ReadBlock(Input& input) {
-        size_t size = input.ReadShort() - 2;
-
-        block_.resize(size);
-        for (size_t i = 0; i < size; ++i) {
-            block_[i] = input.MustReadByte();
+        size_t size = input.ReadShort();
+        if (size < 2) {
+            throw std::invalid_argument("Block is too short");
         }
+
+        block_ = input.MustRead(size - 2);
+        ind_ = 0;
     }
 
     Byte GetByte() {
@@ -84,7 +61,8 @@ protected:
         return block_.size() - ind_;
     }
 
-    std::vector<Byte> block_;
+    // Points into the input, sections copy out what they keep.
+    std::span<const Byte> block_;
     size_t ind_ = 0;
 };
 
@@ -94,18 +72,10 @@ public:
         jpeg.comment_.SetIndex(input.Index());
         ReadBlock(input);
 
-        std::string text(block_.size(), 0);
-        for (size_t i = 0; i < block_.size(); ++i) {
-            text[i] = block_[i];
-        }
-        jpeg.comment_.text_ = text;
+        jpeg.comment_.text_.assign(block_.begin(), block_.end());
 
         return true;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new ComSection());
-    }
 };
 
 class AppSection : public BlockSection {
@@ -116,10 +86,6 @@ public:
 
         return true;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new AppSection());
-    }
 };
 
 class QuantTableSection : public BlockSection {
@@ -135,7 +101,7 @@ public:
             table.len_ = LeftByteHalf(info);
             table.identifier_ = RightByteHalf(info);
 
-            table.data_.resize(kMatrixSquare);
+            // Stored in zigzag order, kept in natural order for the decoder.
             for (size_t i = 0; i < kMatrixSquare; ++i) {
                 size_t value;
                 if (table.len_) {
@@ -143,17 +109,13 @@ public:
                 } else {
                     value = GetByte();
                 }
-                table.data_[i] = value;
+                table.data_[kZigzagToNatural[i]] = value;
             }
 
             jpeg.tables_.AddTable(table, table.identifier_);
         }
         return true;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new QuantTableSection());
-    }
 };
 
 class DhtSection : public BlockSection {
@@ -164,51 +126,66 @@ public:
 
         while (CanGet()) {
             Byte info = GetByte();
-            Dht table;
-            table.class_ = LeftByteHalf(info);
+            size_t table_class = LeftByteHalf(info);
 
-            if (table.class_ >= 2) {
+            if (table_class >= 2) {
                 throw std::invalid_argument("Broken Huffman table class");
             }
 
-            table.identifier_ = RightByteHalf(info);
+            size_t identifier = RightByteHalf(info);
 
-            int values = 0;
+            // Tables are rebuilt in place, so a reused Jpeg keeps their allocations.
+            auto& tables = jpeg.huff_tables_.data_[table_class];
+            tables.resize(std::max(tables.size(), identifier + 1));
+            Dht& table = tables[identifier];
+            table.class_ = table_class;
+            table.identifier_ = identifier;
+            table.defined_ = false;
+
+            // Encoders mostly write the same tables into every file, a tree built from the
+            // same bytes before is kept.
+            bool same = table.built_;
+            table.built_ = false;
+            size_t values = 0;
 
             for (auto& code : table.codes_) {
-                code = GetByte();
+                Byte byte = GetByte();
+                same = same && code == byte;
+                code = byte;
                 values += code;
             }
 
+            same = same && table.values_.size() == values;
             table.values_.resize(values);
 
             for (auto& value : table.values_) {
-                value = GetByte();
+                Byte byte = GetByte();
+                same = same && value == byte;
+                value = byte;
             }
 
-            table.tree_.Build(table.codes_, table.values_);
-
-            jpeg.huff_tables_.data_[table.class_].resize(
-                std::max(jpeg.huff_tables_.data_[table.class_].size(), table.identifier_ + 1));
-
-            jpeg.huff_tables_.data_[table.class_][table.identifier_] = std::move(table);
+            if (!same) {
+                table.tree_.Build(table.codes_, table.values_);
+            }
+            table.built_ = true;
+            table.defined_ = true;
         }
 
         return true;
     }
-
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new DhtSection());
-    }
 };
 
 class InfoSection : public BlockSection {
 public:
+    explicit InfoSection(Byte marker = 0xC0) : marker_(marker) {
+    }
+
     bool ReadField(Input& input, Jpeg& jpeg) override {
         if (jpeg.info_.Exists()) {
             throw std::invalid_argument("Two SOF sections");
         }
         jpeg.info_.SetIndex(input.Index());
+        jpeg.info_.marker_ = marker_;
         ReadBlock(input);
 
         jpeg.info_.precision_ = GetByte();
@@ -235,91 +212,230 @@ public:
         return true;
     }
 
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new InfoSection());
+    Byte Marker() const {
+        return marker_;
+    }
+
+private:
+    Byte marker_;
+};
+
+class DriSection : public BlockSection {
+public:
+    bool ReadField(Input& input, Jpeg& jpeg) override {
+        jpeg.restart_.SetIndex(input.Index());
+        ReadBlock(input);
+
+        jpeg.restart_.mcus_ = Get2Bytes();
+
+        return true;
+    }
+};
+
+// Steps over a section without parsing it.
+class SkipSection : public BlockSection {
+public:
+    bool ReadField(Input& input, Jpeg&) override {
+        ReadBlock(input);
+
+        return true;
+    }
+};
+
+// Ends reading at SOS, leaving the scan untouched.
+class StopSection : public SectionReader {
+public:
+    bool ReadField(Input& input, Jpeg& jpeg) override {
+        jpeg.sos_.SetIndex(input.Index());
+
+        return false;
     }
 };
 
+// Searches the entropy-coded data that starts at input.Index() for its end, the first marker
+// that isn't RSTn, and fills sos.data_ and sos.restarts_. RSTn markers have to follow the
+// RST0-RST7 cycle, one out of order means lost data. Baseline: the single scan runs up to
+// EOI, which is consumed and reading stops. Progressive: the marker is left for the next
+// field. If the input ends first and |partial| is set, sos.open_ is set, nothing is
+// consumed and calling again with more input continues the search.
+inline bool FindScanEnd(Input& input, Jpeg& jpeg, bool partial) {
+    auto& sos = jpeg.sos_;
+    std::span<const Byte> rest = input.Rest();
+    size_t pos = sos.checked_;
+    while (true) {
+        const void* found = std::memchr(rest.data() + pos, 0xFF, rest.size() - pos);
+        if (found) {
+            pos = static_cast<const Byte*>(found) - rest.data() + 1;
+        }
+        if (!found || pos == rest.size()) {
+            if (!partial) {
+                throw std::invalid_argument("Input Ended");
+            }
+            // A trailing 0xFF waits for the byte that tells stuffing from a marker.
+            sos.checked_ = found ? pos - 1 : rest.size();
+            sos.data_ = rest.first(sos.checked_);
+            sos.open_ = true;
+            return true;
+        }
+
+        Byte mark = rest[pos++];
+        if (mark >= 0xD0 && mark <= 0xD7) {
+            if (mark != 0xD0 + sos.restarts_.size() % 8) {
+                throw std::invalid_argument("RST marker out of order");
+            }
+            sos.restarts_.push_back(pos);
+            continue;
+        }
+        if (mark == 0x00) {
+            continue;
+        }
+
+        sos.data_ = rest.first(pos - 2);
+        sos.open_ = false;
+        ++sos.scans_;
+        if (jpeg.info_.marker_ == 0xC2) {
+            // The marker is read as the next field.
+            input.Skip(pos - 2);
+            return true;
+        }
+        if (mark != 0xD9) {
+            throw std::invalid_argument("FF XX byte found while scanning SOS");
+        }
+        input.Skip(pos);
+        jpeg.end_.SetIndex(input.Index());
+        return false;
+    }
+}
+
+// Progressive scans are left in jpeg.sos_ for the decoder, which takes each one before
+// reading on (tables may change between scans). With |partial| the scan may end with the
+// input, see FindScanEnd.
 class SosSection : public BlockSection {
 public:
+    explicit SosSection(bool partial = false) : partial_(partial) {
+    }
+
     bool ReadField(Input& input, Jpeg& jpeg) override {
         jpeg.sos_.SetIndex(input.Index());
         ReadBlock(input);
 
+        bool progressive = jpeg.info_.marker_ == 0xC2;
+        auto& sos = jpeg.sos_;
+
         size_t channels = GetByte();
-        jpeg.sos_.SetChannels(channels);
+        if (progressive) {
+            if (channels == 0 || channels > sos.channels_.size()) {
+                throw std::invalid_argument("Broken channels");
+            }
+        } else {
+            sos.SetChannels(channels);
+        }
 
+        sos.components_.clear();
         for (size_t i = 0; i < channels; ++i) {
             size_t id = GetByte() - 1;
-            if (id >= channels) {
+            if (id >= sos.channels_.size()) {
                 throw std::invalid_argument("Channel id broken");
             }
 
-            auto& channel = jpeg.sos_.channels_[id];
+            auto& channel = sos.channels_[id];
             channel.identifier_ = id;
+            sos.components_.push_back(id);
 
             Byte t_id = GetByte();
             channel.table_id[0] = LeftByteHalf(t_id);
             channel.table_id[1] = RightByteHalf(t_id);
         }
 
-        Byte sos_end[3];
-        Byte sos_end_must_be[3] = {0, 0x3F, 0};
-        for (size_t i = 0; i < 3; ++i) {
-            sos_end[i] = GetByte();
-            if (sos_end[i] != sos_end_must_be[i]) {
-                throw std::invalid_argument("Invalid SOS section end");
-            }
-        }
-
-        while (true) {
-            Byte byte = input.MustReadByte();
-
-            if (byte == 0xFF) {
-                Byte mark = input.MustReadByte();
-                if (mark != 0x00 && mark != 0xD9) {
-                    throw std::invalid_argument("FF XX byte found while scanning SOS");
-                }
-
-                if (mark == 0xD9) {
-                    jpeg.end_.SetIndex(input.Index());
-                    break;
-                }
-            }
-
-            for (int i = 7; i >= 0; --i) {
-                jpeg.sos_.data_.push_back(GetBit(byte, i));
-            }
+        sos.ss_ = GetByte();
+        sos.se_ = GetByte();
+        Byte approximation = GetByte();
+        sos.ah_ = LeftByteHalf(approximation);
+        sos.al_ = RightByteHalf(approximation);
+        if (!progressive && (sos.ss_ != 0 || sos.se_ != 0x3F || approximation != 0)) {
+            throw std::invalid_argument("Invalid SOS section end");
         }
 
-        return false;
+        sos.restarts_.clear();
+        sos.checked_ = 0;
+        sos.offset_ = input.Index();
+        return FindScanEnd(input, jpeg, partial_);
     }
 
-    SectionReaderPtr Copy() override {
-        return SectionReaderPtr(new SosSection());
-    }
+private:
+    bool partial_;
 };
 
-template <class T>
-SectionReaderPtr CreateSectionReaderPtr() {
-    return SectionReaderPtr(new T());
-}
+enum class ReadMode {
+    // Whole files: a field that runs past the input is an error.
+    kFull,
+    // SOI, COM, SOFn and DRI up to SOS. Tables are skipped unparsed and the scan is never
+    // looked at.
+    kHeaderOnly,
+    // Input that arrives in chunks: check FieldAvailable() before ReadField(), and while
+    // jpeg.sos_.open_ is set call ContinueScan() once more input is there.
+    kIncremental,
+};
 
 class Reader {
 public:
     Reader() = delete;
 
-    Reader(Input& input, Jpeg& jpeg) : input_(input), jpeg_(jpeg) {
-        AddReader(0xD8, CreateSectionReaderPtr<BeginSection>());
-        AddReader(0xD9, CreateSectionReaderPtr<EndSection>());
-        AddReader(0xFE, CreateSectionReaderPtr<ComSection>());
+    Reader(Input& input, Jpeg& jpeg, ReadMode mode = ReadMode::kFull)
+        : input_(input),
+          jpeg_(jpeg),
+          partial_(mode == ReadMode::kIncremental),
+          info_{InfoSection(0xC0), InfoSection(0xC1), InfoSection(0xC2)},
+          sos_(partial_) {
+        readers_.fill(nullptr);
+        readers_[0xD8] = &begin_;
+        readers_[0xD9] = &end_;
+        readers_[0xFE] = &com_;
+        readers_[0xDD] = &dri_;
+        // Baseline, extended sequential and progressive Huffman frames.
+        for (auto& info : info_) {
+            readers_[info.Marker()] = &info;
+        }
+
+        if (mode == ReadMode::kHeaderOnly) {
+            for (Byte i = 0xE0; i <= 0xEF; ++i) {
+                readers_[i] = &skip_;
+            }
+            readers_[0xDB] = &skip_;
+            readers_[0xC4] = &skip_;
+            readers_[0xDA] = &stop_;
+            return;
+        }
+
         for (Byte i = 0xE0; i <= 0xEF; ++i) {
-            AddReader(i, CreateSectionReaderPtr<AppSection>());
+            readers_[i] = &app_;
         }
-        AddReader(0xDB, CreateSectionReaderPtr<QuantTableSection>());
-        AddReader(0xC4, CreateSectionReaderPtr<DhtSection>());
-        AddReader(0xC0, CreateSectionReaderPtr<InfoSection>());
-        AddReader(0xDA, CreateSectionReaderPtr<SosSection>());
+        readers_[0xDB] = &quant_;
+        readers_[0xC4] = &dht_;
+        readers_[0xDA] = &sos_;
+    }
+
+    // Points into the reader itself.
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // True if the next field is complete in the input: the whole segment, or for SOS the
+    // segment without the scan. Malformed fields count as available, ReadField reports them.
+    bool FieldAvailable() const {
+        auto rest = input_.Rest();
+        if (rest.size() < 2) {
+            return false;
+        }
+        Byte marker = rest[1];
+        if (rest[0] != 0xFF || marker == 0xD8 || marker == 0xD9) {
+            return true;
+        }
+        return rest.size() >= 4 && rest.size() >= 2 + Merge(rest[2], rest[3]);
+    }
+
+    // Continues an open scan with the input received since, see FindScanEnd.
+    bool ContinueScan() {
+        return FindScanEnd(input_, jpeg_, partial_);
     }
 
     bool ReadField() {
@@ -331,31 +447,30 @@ public:
         }
 
         Byte marker_byte = input_.MustReadByte();
-        Marker mark(marker_byte);
-
-        if (!ExistsReader(mark)) {
+        SectionReader* reader = readers_[marker_byte];
+        if (!reader) {
             throw std::invalid_argument("Invalid marker" + std::to_string(marker_byte));
         }
 
-        auto reader = GetReader(mark);
         return reader->ReadField(input_, jpeg_);
     }
 
 private:
-    SectionReaderPtr GetReader(Marker mark) {
-        return section_readers_[mark]->Copy();
-    }
-
-    void AddReader(Marker mark, SectionReaderPtr ptr) {
-        section_readers_[mark] = std::move(ptr);
-    }
-
-    bool ExistsReader(Marker mark) {
-        return section_readers_.count(mark);
-    }
-
     Input& input_;
     Jpeg& jpeg_;
-
-    std::map<Marker, SectionReaderPtr> section_readers_;
+    bool partial_ = false;
+
+    BeginSection begin_;
+    EndSection end_;
+    ComSection com_;
+    DriSection dri_;
+    InfoSection info_[3];
+    SkipSection skip_;
+    StopSection stop_;
+    AppSection app_;
+    QuantTableSection quant_;
+    DhtSection dht_;
+    SosSection sos_;
+    // By marker byte, null for markers that are not accepted.
+    std::array<SectionReader*, 256> readers_;
 };
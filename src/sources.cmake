@@ -1,7 +1,25 @@
-add_library(decoder_baseline
+# Sources of the jpeg_decoder library, everything but main.cpp. The command line tool,
+# decoder_bench and decoder_fuzz all link that one library. The optional sources are added
+# by the top-level CMakeLists.txt when FFTW or an x86-64 compiler is there.
+set(JPEG_DECODER_SOURCES
+    ${CMAKE_CURRENT_LIST_DIR}/decoder.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/huffman.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/idct.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/color.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/arena.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/thread_pool.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/jpeg_decoder.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/batch.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/mapped_file.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/jpg_to_png.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/png_encoder.cpp
+)
 
-        # maybe your files here
+# The reference IDCT backend, only with FFTW.
+set(JPEG_DECODER_FFTW_SOURCES ${CMAKE_CURRENT_LIST_DIR}/fft.cpp)
 
-        huffman.cpp
-        fft.cpp
-        decoder.cpp)
+# Compiled with -mavx2 and picked at runtime.
+set(JPEG_DECODER_AVX2_SOURCES
+    ${CMAKE_CURRENT_LIST_DIR}/idct_avx2.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/color_avx2.cpp
+)
@@ -0,0 +1,217 @@
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool::Impl {
+public:
+    explicit Impl(size_t threads) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 1; i < threads; ++i) {
+            workers_.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    size_t Size() const {
+        return workers_.size() + 1;
+    }
+
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+        if (count == 0) {
+            return;
+        }
+        if (workers_.empty() || count == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                task(i);
+            }
+            return;
+        }
+
+        Job job(task, count, Size());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        Run(job, 0);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            finished_.wait(lock, [this] { return busy_ == 0; });
+            job_ = nullptr;
+        }
+
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+
+private:
+    // Indices [begin, end) still owned by one participant. The owner takes from the front,
+    // thieves take the back half.
+    struct Range {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    struct Job {
+        Job(const std::function<void(size_t)>& task, size_t count, size_t participants)
+            : task(task), ranges(participants) {
+            // Contiguous initial chunks keep neighbouring rows on one thread.
+            for (size_t i = 0; i < participants; ++i) {
+                ranges[i].begin = count * i / participants;
+                ranges[i].end = count * (i + 1) / participants;
+            }
+        }
+
+        const std::function<void(size_t)>& task;
+        std::vector<Range> ranges;
+        std::atomic<bool> cancelled = false;
+
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    static bool Pop(Job& job, size_t self, size_t& index) {
+        auto& range = job.ranges[self];
+        std::lock_guard<std::mutex> lock(range.mutex);
+        if (job.cancelled || range.begin == range.end) {
+            return false;
+        }
+        index = range.begin++;
+        return true;
+    }
+
+    // Moves the back half of the fullest other range to |self|.
+    static bool Steal(Job& job, size_t self) {
+        while (!job.cancelled) {
+            size_t victim = self;
+            size_t most = 0;
+            for (size_t i = 0; i < job.ranges.size(); ++i) {
+                auto& range = job.ranges[i];
+                std::lock_guard<std::mutex> lock(range.mutex);
+                if (i != self && range.end - range.begin > most) {
+                    most = range.end - range.begin;
+                    victim = i;
+                }
+            }
+            if (victim == self) {
+                return false;
+            }
+
+            size_t begin, end;
+            {
+                auto& range = job.ranges[victim];
+                std::lock_guard<std::mutex> lock(range.mutex);
+                size_t left = range.end - range.begin;
+                if (left == 0) {
+                    continue;
+                }
+                end = range.end;
+                begin = end - (left + 1) / 2;
+                range.end = begin;
+            }
+
+            auto& own = job.ranges[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = begin;
+            own.end = end;
+            return true;
+        }
+        return false;
+    }
+
+    static void Run(Job& job, size_t self) {
+        while (true) {
+            size_t index;
+            if (!Pop(job, self, index)) {
+                if (Steal(job, self)) {
+                    continue;
+                }
+                return;
+            }
+
+            try {
+                job.task(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(job.error_mutex);
+                if (!job.error) {
+                    job.error = std::current_exception();
+                }
+                job.cancelled = true;
+            }
+        }
+    }
+
+    void WorkerLoop(size_t self) {
+        uint64_t seen = 0;
+        while (true) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+                job = job_;
+                if (!job) {
+                    continue;
+                }
+                ++busy_;
+            }
+
+            Run(*job, self);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --busy_;
+            }
+            finished_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable finished_;
+    Job* job_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t busy_ = 0;
+    bool stop_ = false;
+};
+
+ThreadPool::ThreadPool(size_t threads) : impl_(new Impl(threads)) {
+}
+
+ThreadPool::~ThreadPool() = default;
+
+size_t ThreadPool::Size() const {
+    return impl_->Size();
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+    impl_->ParallelFor(count, task);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+// Fixed set of worker threads for data-parallel loops inside one decode.
+class ThreadPool {
+public:
+    // |threads| counts the calling thread too, 0 means one per hardware thread.
+    explicit ThreadPool(size_t threads);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    size_t Size() const;
+
+    // Runs task(i) for every i in [0, count) on the workers and the calling thread and
+    // returns once all of them finished. Every thread starts on its own contiguous chunk of
+    // indices and steals half of the largest remaining chunk when it runs dry. The first
+    // exception thrown by a task is rethrown here, the remaining indices are skipped.
+    // Calls must not be nested.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,113 @@
+// YCbCrToRgbRow and its SSE2 and AVX2 kernels against libjpeg's jdcolor formula, for every
+// Y, Cb and Cr value, with full-resolution and horizontally shared chroma.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "color.h"
+#include "test_util.h"
+
+namespace {
+
+// jdcolor's FIX(1.40200), FIX(0.34414), FIX(0.71414) and FIX(1.77200) with 16 fraction bits.
+constexpr int32_t kFix1402 = 91881;
+constexpr int32_t kFix0344 = 22554;
+constexpr int32_t kFix0714 = 46802;
+constexpr int32_t kFix1772 = 116130;
+
+// What jdcolor adds to Y for each channel: its Cr_r_tab, Cb_g_tab + Cr_g_tab and Cb_b_tab.
+void ReferenceOffsets(int cb, int cr, int offsets[3]) {
+    int blue = cb - 128;
+    int red = cr - 128;
+    int half = 1 << 15;
+    offsets[0] = (kFix1402 * red + half) >> 16;
+    offsets[1] = (-kFix0344 * blue - kFix0714 * red + half) >> 16;
+    offsets[2] = (kFix1772 * blue + half) >> 16;
+}
+
+// A conversion of one row, returning how many pixels it did.
+using Converter = size_t (*)(const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+                             size_t width, int chroma_shift, uint8_t* out);
+
+size_t WholeRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, size_t width,
+                int chroma_shift, uint8_t* out) {
+    YCbCrToRgbRow(y, cb, cr, width, chroma_shift, out);
+    return width;
+}
+
+// Converts rows of |width| pixels where pixel x has Y y0 + x and the chroma (cb + 3j,
+// cr + 5j) of its sample j, modulo 256, and checks the pixels |convert| did. With every
+// (cb, cr) and y0 stepping by |width|, each Y, Cb, Cr triple comes up. The buffers are
+// exactly as large as the row, so the sanitizer builds catch accesses past it.
+void CheckAllValues(Converter convert, size_t width, int chroma_shift,
+                    const std::string& context) {
+    size_t chroma_width = (width + (1 << chroma_shift) - 1) >> chroma_shift;
+    std::vector<uint8_t> y(width);
+    std::vector<uint8_t> cb(chroma_width);
+    std::vector<uint8_t> cr(chroma_width);
+    std::vector<uint8_t> out(3 * width);
+
+    std::vector<int> offsets(3 * chroma_width);
+
+    size_t mismatches = 0;
+    for (int cb0 = 0; cb0 < 256; ++cb0) {
+        for (int cr0 = 0; cr0 < 256; ++cr0) {
+            for (size_t j = 0; j < chroma_width; ++j) {
+                cb[j] = static_cast<uint8_t>(cb0 + 3 * j);
+                cr[j] = static_cast<uint8_t>(cr0 + 5 * j);
+                ReferenceOffsets(cb[j], cr[j], &offsets[3 * j]);
+            }
+            for (size_t y0 = 0; y0 < 256; y0 += width) {
+                for (size_t x = 0; x < width; ++x) {
+                    y[x] = static_cast<uint8_t>(y0 + x);
+                }
+                size_t done = convert(y.data(), cb.data(), cr.data(), width, chroma_shift,
+                                      out.data());
+                const uint8_t* pixel = out.data();
+                for (size_t x = 0; x < done; ++x, pixel += 3) {
+                    const int* offset = &offsets[3 * (x >> chroma_shift)];
+                    for (int channel = 0; channel < 3; ++channel) {
+                        mismatches +=
+                            pixel[channel] != std::clamp(y[x] + offset[channel], 0, 255);
+                    }
+                }
+            }
+        }
+    }
+    EXPECT(mismatches == 0, context + ": " + std::to_string(mismatches) + " wrong samples");
+}
+
+}  // namespace
+
+int main() {
+    struct Backend {
+        const char* name;
+        Converter convert;
+        // Pixels the kernel leaves to scalar code, it is only run on wider rows.
+        size_t min_width;
+    };
+    std::vector<Backend> backends = {{"YCbCrToRgbRow", WholeRow, 1}};
+#if defined(__SSE2__)
+    backends.push_back({"YCbCrToRgbSse2", YCbCrToRgbSse2, 17});
+#endif
+#if defined(JPEG_DECODER_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        backends.push_back({"YCbCrToRgbAvx2", YCbCrToRgbAvx2, 32});
+    }
+#endif
+
+    for (const auto& backend : backends) {
+        for (int chroma_shift : {0, 1}) {
+            for (size_t width : {1, 15, 16, 17, 33}) {
+                if (width >= backend.min_width) {
+                    CheckAllValues(backend.convert, width, chroma_shift,
+                                   std::string(backend.name) + " width " +
+                                       std::to_string(width) + " shift " +
+                                       std::to_string(chroma_shift));
+                }
+            }
+        }
+    }
+    return Failures() != 0;
+}
@@ -0,0 +1,61 @@
+// DecodeOptions::crop has to give exactly the pixels of the full decode inside the rectangle,
+// at every scale and with both upsampling modes.
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+bool SameAsRegion(const Image& crop, const Image& full, const Crop& region) {
+    if (crop.Width() != region.width || crop.Height() != region.height) {
+        return false;
+    }
+    size_t channels = full.Channels();
+    for (size_t y = 0; y < region.height; ++y) {
+        const uint8_t* expected = full.Row(region.y + y) + region.x * channels;
+        if (std::memcmp(crop.Row(y), expected, region.width * channels)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    // 4:2:0 with and without restart markers, the former skips the intervals above the crop.
+    for (std::string name : {"lenna_small.jpg", "lenna_small_restart.jpg"}) {
+        std::vector<uint8_t> data = ReadTestFile(name);
+        for (auto upsampling : {Upsampling::kNearest, Upsampling::kFancy}) {
+            for (size_t scale : {1, 2, 4, 8}) {
+                DecodeOptions options;
+                options.upsampling = upsampling;
+                options.scale = scale;
+                Image full = Decode(data, options);
+                size_t width = full.Width();
+                size_t height = full.Height();
+                // A single pixel, one off the MCU grid, the right and bottom border and all.
+                std::vector<Crop> regions = {{0, 0, 1, 1},
+                                             {1, 1, width / 2, height / 3},
+                                             {width / 3, height / 2, width - width / 3, 1},
+                                             {width - 1, 0, 1, height},
+                                             {0, 0, width, height}};
+                for (const Crop& region : regions) {
+                    std::string context = name + " at 1/" + std::to_string(scale) + ", " +
+                                          std::to_string(region.width) + "x" +
+                                          std::to_string(region.height) + "+" +
+                                          std::to_string(region.x) + "+" +
+                                          std::to_string(region.y) +
+                                          (upsampling == Upsampling::kFancy ? " fancy" : "");
+                    options.crop = region;
+                    EXPECT(SameAsRegion(Decode(data, options), full, region), context);
+                }
+            }
+        }
+    }
+    return Failures() != 0;
+}
@@ -0,0 +1,58 @@
+// Fancy upsampling against libjpeg's do_fancy_upsampling. With the scalar IDCT (the islow
+// layout) the samples are bit-exact, so every difference is an upsampling one.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+struct Case {
+    const char* name;
+    const char* description;
+};
+
+// Widths that aren't a multiple of 16 leave chroma after the SSE2 kernels' 8 sample steps
+// to the scalar loop, the heights take the context rows across two MCU row boundaries and
+// up to a partial last one.
+constexpr Case kCases[] = {
+    {"fancy_420", "83x45, H2V2"},
+    {"fancy_422", "61x37, H2V1"},
+    {"fancy_440", "45x29, H1V2"},
+};
+
+bool Identical(const Image& image, const Image& reference) {
+    if (image.Width() != reference.Width() || image.Height() != reference.Height()) {
+        return false;
+    }
+    for (size_t y = 0; y < image.Height(); ++y) {
+        if (!std::equal(image.RowSpan(y).begin(), image.RowSpan(y).end(),
+                        reference.RowSpan(y).begin())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    for (const auto& test : kCases) {
+        std::string context = std::string(test.name) + ".jpg (" + test.description + ")";
+        std::vector<uint8_t> data = ReadTestFile(std::string(test.name) + ".jpg");
+        Image reference = ReadTestPng(std::string(test.name) + ".png");
+
+        DecodeOptions options;
+        options.upsampling = Upsampling::kFancy;
+        options.idct = IdctBackend::kScalar;
+        EXPECT(Identical(Decode(data, options), reference), context);
+
+        // The vector IDCTs only add their rounding.
+        options.idct = IdctBackend::kAuto;
+        ExpectNearReference(Decode(data, options), reference, context + " auto IDCT");
+    }
+    return Failures() != 0;
+}
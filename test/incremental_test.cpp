@@ -0,0 +1,73 @@
+// IncrementalDecoder has to give exactly the pixels of Decode whatever the input is cut into.
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+// Copies the rows it gets into an Image.
+class ImageRows : public RowSink {
+public:
+    void Begin(const ImageHeader& header) override {
+        image.SetSize(header.width, header.height, header.format);
+    }
+
+    void WriteRow(size_t y, std::span<const uint8_t> row) override {
+        std::copy(row.begin(), row.end(), image.Row(y));
+    }
+
+    Image image;
+};
+
+bool Same(const Image& image, const Image& expected) {
+    if (image.Width() != expected.Width() || image.Height() != expected.Height()) {
+        return false;
+    }
+    for (size_t y = 0; y < image.Height(); ++y) {
+        auto row = image.RowSpan(y);
+        if (std::memcmp(row.data(), expected.Row(y), row.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    for (std::string name :
+         {"lenna_small.jpg", "lenna_small_restart.jpg", "lenna_small_progressive.jpg"}) {
+        std::vector<uint8_t> data = ReadTestFile(name);
+        Image full = Decode(data);
+        for (size_t chunk : {1, 7, 100, 4096, 1 << 20}) {
+            std::string context = name + " in " + std::to_string(chunk) + " byte chunks";
+            ImageRows rows;
+            IncrementalDecoder decoder(rows);
+            bool done = false;
+            size_t half_rows = 0;
+            for (size_t offset = 0; offset < data.size(); offset += chunk) {
+                if (offset <= data.size() / 2) {
+                    half_rows = decoder.RowsDone();
+                }
+                size_t size = std::min(chunk, data.size() - offset);
+                done = decoder.Feed({data.data() + offset, size});
+            }
+            decoder.Finish();
+            EXPECT(done, context);
+            EXPECT(decoder.RowsDone() == full.Height(), context);
+            EXPECT(Same(rows.image, full), context);
+            // Sequential files are emitted while they arrive, progressive ones at the end.
+            bool progressive = name == "lenna_small_progressive.jpg";
+            if (chunk < data.size() / 2) {
+                EXPECT(progressive ? half_rows == 0 : half_rows > 0, context);
+            }
+        }
+    }
+    return Failures() != 0;
+}
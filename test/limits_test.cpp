@@ -0,0 +1,134 @@
+// Every DecodeLimits field has to stop a decode that exceeds it with DecodeLimitError and let
+// one exactly at it through.
+
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+// Whether |decode| throws DecodeLimitError, other errors count as not.
+template <class F>
+bool ThrowsLimit(F decode) {
+    try {
+        decode();
+    } catch (const DecodeLimitError&) {
+        return true;
+    } catch (const std::exception&) {
+    }
+    return false;
+}
+
+bool LimitsDecode(const std::vector<uint8_t>& data, const DecodeLimits& limits) {
+    DecodeOptions options;
+    options.limits = limits;
+    return ThrowsLimit([&] { Decode(data, options); });
+}
+
+// Entropy-coded bytes of all scans of |data|, RST markers and stuffed zeros included, which
+// is what max_scan_bytes counts. Walks the marker segments on its own.
+size_t ScanBytes(const std::vector<uint8_t>& data) {
+    size_t total = 0;
+    size_t pos = 2;
+    while (pos + 4 <= data.size() && data[pos + 1] != 0xD9) {
+        bool sos = data[pos + 1] == 0xDA;
+        pos += 2 + (data[pos + 2] << 8 | data[pos + 3]);
+        if (!sos) {
+            continue;
+        }
+        size_t start = pos;
+        auto in_scan = [&](uint8_t next) { return next == 0 || (next >= 0xD0 && next <= 0xD7); };
+        while (pos + 1 < data.size() && (data[pos] != 0xFF || in_scan(data[pos + 1]))) {
+            ++pos;
+        }
+        total += pos - start;
+    }
+    return total;
+}
+
+class NullRows : public RowSink {
+public:
+    void Begin(const ImageHeader&) override {
+    }
+
+    void WriteRow(size_t, std::span<const uint8_t>) override {
+    }
+};
+
+}  // namespace
+
+int main() {
+    // 227x149, the progressive one keeps every coefficient in memory, the scans of the
+    // restart one count their RST markers.
+    for (std::string name :
+         {"lenna_small.jpg", "lenna_small_progressive.jpg", "lenna_small_restart.jpg"}) {
+        std::vector<uint8_t> data = ReadTestFile(name);
+        DecodeLimits limits;
+
+        limits.max_pixels = 227 * 149 - 1;
+        EXPECT(LimitsDecode(data, limits), name + " max_pixels");
+        limits.max_pixels = 227 * 149;
+        EXPECT(!LimitsDecode(data, limits), name + " max_pixels");
+
+        limits = {};
+        size_t scan_bytes = ScanBytes(data);
+        limits.max_scan_bytes = scan_bytes - 1;
+        EXPECT(LimitsDecode(data, limits), name + " max_scan_bytes");
+        limits.max_scan_bytes = scan_bytes;
+        EXPECT(!LimitsDecode(data, limits), name + " max_scan_bytes");
+
+        // The buffers besides the image depend on the decoder's layout, so the least limit
+        // that passes is searched for. Decode() counts the output image, 227x149 RGB, and
+        // the rest is small next to it.
+        limits = {};
+        size_t low = 1;
+        size_t high = 10 << 20;
+        while (low < high) {
+            limits.max_memory = (low + high) / 2;
+            if (LimitsDecode(data, limits)) {
+                low = limits.max_memory + 1;
+            } else {
+                high = limits.max_memory;
+            }
+        }
+        EXPECT(low > 227 * 149 * 3 && low < 3 * 227 * 149 * 3, name + " max_memory");
+        limits.max_memory = low - 1;
+        EXPECT(LimitsDecode(data, limits), name + " max_memory");
+        limits.max_memory = low;
+        EXPECT(!LimitsDecode(data, limits), name + " max_memory");
+
+        limits = {};
+        std::atomic<bool> cancel{true};
+        limits.cancel = &cancel;
+        EXPECT(LimitsDecode(data, limits), name + " cancel");
+        cancel = false;
+        EXPECT(!LimitsDecode(data, limits), name + " cancel");
+
+        // The timeout runs from the construction of the decoder, so it is over before the
+        // first byte arrives.
+        NullRows rows;
+        DecodeOptions options;
+        options.limits.timeout = std::chrono::milliseconds(1);
+        IncrementalDecoder decoder(rows, options);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT(ThrowsLimit([&] {
+                   decoder.Feed(data);
+                   decoder.Finish();
+               }),
+               name + " timeout");
+        options.limits.timeout = std::chrono::seconds(60);
+        EXPECT(!ThrowsLimit([&] {
+                   IncrementalDecoder in_time(rows, options);
+                   in_time.Feed(data);
+                   in_time.Finish();
+               }),
+               name + " timeout");
+    }
+    return Failures() != 0;
+}
@@ -0,0 +1,21 @@
+// Progressive files (SOF2: spectral selection and successive approximation scans) against
+// libjpeg.
+
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+int main() {
+    std::vector<uint8_t> data = ReadTestFile("lenna_small_progressive.jpg");
+    Image reference = ReadTestPng("lenna_small_progressive.png");
+    for (size_t threads : {1, 4}) {
+        DecodeOptions options;
+        options.threads = threads;
+        ExpectNearReference(
+            Decode(data, options), reference,
+            "lenna_small_progressive.jpg with " + std::to_string(threads) + " threads");
+    }
+    return Failures() != 0;
+}
@@ -0,0 +1,66 @@
+// Files with restart markers (DRI/RSTn) against libjpeg, with the intervals decoded by one
+// thread and in parallel. RSTn markers out of their cycle are rejected.
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+// Offsets of the RSTn marker bytes (the byte after 0xFF) in the scan of |data|.
+std::vector<size_t> RestartMarkers(const std::vector<uint8_t>& data) {
+    std::vector<size_t> markers;
+    const uint8_t kSos[] = {0xFF, 0xDA};
+    auto scan = std::search(data.begin(), data.end(), kSos, kSos + 2);
+    for (size_t i = scan - data.begin() + 2; i + 1 < data.size(); ++i) {
+        if (data[i] == 0xFF && data[i + 1] >= 0xD0 && data[i + 1] <= 0xD7) {
+            markers.push_back(i + 1);
+        }
+    }
+    return markers;
+}
+
+bool Rejects(const std::vector<uint8_t>& data, const DecodeOptions& options) {
+    try {
+        Decode(data, options);
+    } catch (const std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+int main() {
+    std::vector<uint8_t> data = ReadTestFile("lenna_small_restart.jpg");
+    Image reference = ReadTestPng("lenna_small_restart.png");
+    for (size_t threads : {1, 4}) {
+        DecodeOptions options;
+        options.threads = threads;
+        ExpectNearReference(Decode(data, options), reference,
+                            "lenna_small_restart.jpg with " + std::to_string(threads) + " threads");
+    }
+
+    std::vector<size_t> markers = RestartMarkers(data);
+    EXPECT(markers.size() > 8, "RST markers of lenna_small_restart.jpg");
+    for (size_t threads : {1, 4}) {
+        DecodeOptions options;
+        options.threads = threads;
+        std::string context = " with " + std::to_string(threads) + " threads";
+
+        // RST1 where RST0 belongs, as if an interval went missing.
+        std::vector<uint8_t> skipped = data;
+        skipped[markers[0]] = 0xD1;
+        EXPECT(Rejects(skipped, options), "skipped RST0" + context);
+
+        // The cycle wraps from RST7 to RST0.
+        std::vector<uint8_t> unwrapped = data;
+        unwrapped[markers[8]] = 0xD7;
+        EXPECT(Rejects(unwrapped, options), "RST7 after RST7" + context);
+    }
+    return Failures() != 0;
+}
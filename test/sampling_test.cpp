@@ -0,0 +1,62 @@
+// Unusual sampling factors: luma sampled lower than chroma against libjpeg, files that need a
+// component upsampled by a fraction are rejected.
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+bool Rejects(const std::vector<uint8_t>& data, const DecodeOptions& options) {
+    try {
+        Decode(data, options);
+    } catch (const std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+int main() {
+    // 50x16, Y 3x1, Cb 2x1, Cr 1x1: Cb would be upsampled by 3/2.
+    std::vector<uint8_t> fractional = ReadTestFile("sampling_3x1_2x1_1x1.jpg");
+    for (auto upsampling : {Upsampling::kNearest, Upsampling::kFancy}) {
+        for (size_t scale : {1, 2, 4, 8}) {
+            DecodeOptions options;
+            options.upsampling = upsampling;
+            options.scale = scale;
+            EXPECT(Rejects(fractional, options),
+                   "sampling_3x1_2x1_1x1.jpg at 1/" + std::to_string(scale));
+        }
+    }
+
+    // 40x40, Y 1x1, Cb and Cr 2x2: the luma is upsampled like chroma usually is.
+    std::vector<uint8_t> low_luma = ReadTestFile("sampling_1x1_2x2_2x2.jpg");
+    for (auto upsampling : {Upsampling::kNearest, Upsampling::kFancy}) {
+        bool fancy = upsampling == Upsampling::kFancy;
+        std::string context = std::string("sampling_1x1_2x2_2x2.jpg") + (fancy ? " fancy" : "");
+        DecodeOptions options;
+        options.upsampling = upsampling;
+        Image full = Decode(low_luma, options);
+        ExpectNearReference(
+            full,
+            ReadTestPng(fancy ? "sampling_1x1_2x2_2x2_fancy.png" : "sampling_1x1_2x2_2x2.png"),
+            context);
+
+        // Off the luma sample grid.
+        options.crop = {3, 5, 27, 31};
+        Image crop = Decode(low_luma, options);
+        bool same = crop.Width() == 27 && crop.Height() == 31;
+        for (size_t y = 0; same && y < 31; ++y) {
+            same = std::equal(crop.RowSpan(y).begin(), crop.RowSpan(y).end(),
+                              full.Row(5 + y) + 3 * 3);
+        }
+        EXPECT(same, context + " cropped");
+    }
+    return Failures() != 0;
+}
@@ -0,0 +1,55 @@
+// DecodeOptions::scale against the full-size decode.
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "test_util.h"
+
+namespace {
+
+// Root mean square difference of |small| from |full| box-downsampled by |scale|. Samples at
+// the right and bottom border whose box sticks out of the image are left out, the decoder
+// averages the encoder's padding into them.
+double BoxRms(const Image& full, const Image& small, size_t scale) {
+    size_t channels = full.Channels();
+    size_t width = full.Width() / scale;
+    size_t height = full.Height() / scale;
+    double squares = 0;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            for (size_t c = 0; c < channels; ++c) {
+                double sum = 0;
+                for (size_t fy = y * scale; fy < (y + 1) * scale; ++fy) {
+                    for (size_t fx = x * scale; fx < (x + 1) * scale; ++fx) {
+                        sum += full.Row(fy)[fx * channels + c];
+                    }
+                }
+                double diff = small.Row(y)[x * channels + c] - sum / (scale * scale);
+                squares += diff * diff;
+            }
+        }
+    }
+    return std::sqrt(squares / (width * height * channels));
+}
+
+}  // namespace
+
+int main() {
+    // 4:4:4 and 4:2:0, the chroma of the latter goes through a larger IDCT than the luma.
+    for (std::string name : {"lenna.jpg", "lenna_small.jpg"}) {
+        std::vector<uint8_t> data = ReadTestFile(name);
+        Image full = Decode(data);
+        for (size_t scale : {2, 4, 8}) {
+            std::string context = name + " at 1/" + std::to_string(scale);
+            DecodeOptions options;
+            options.scale = scale;
+            Image small = Decode(data, options);
+            EXPECT(small.Width() == (full.Width() - 1) / scale + 1, context);
+            EXPECT(small.Height() == (full.Height() - 1) / scale + 1, context);
+            EXPECT(BoxRms(full, small, scale) < 1.0, context);
+        }
+    }
+    return Failures() != 0;
+}
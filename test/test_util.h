@@ -0,0 +1,80 @@
+#pragma once
+
+#include <png.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+// Checks failed so far, what main() of a test returns.
+inline int& Failures() {
+    static int failures = 0;
+    return failures;
+}
+
+// Reports |condition| with |context| (the image, scale or option under test) when it fails
+// and keeps going, so one run lists every failure.
+#define EXPECT(condition, context)                                                          \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: %s failed for %s\n", __FILE__, __LINE__, #condition, \
+                         std::string(context).c_str());                                     \
+            ++Failures();                                                                   \
+        }                                                                                   \
+    } while (false)
+
+// Bytes of |name| in the test directory.
+inline std::vector<uint8_t> ReadTestFile(const std::string& name) {
+    std::ifstream input(std::string(DECODER_TEST_DATA_DIR) + "/" + name, std::ios::binary);
+    if (!input) {
+        throw std::invalid_argument("Can't open " + name);
+    }
+    return {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+}
+
+// RGB pixels of the PNG |name| in the test directory.
+inline Image ReadTestPng(const std::string& name) {
+    std::vector<uint8_t> data = ReadTestFile(name);
+    png_image png{};
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&png, data.data(), data.size())) {
+        throw std::invalid_argument("Broken PNG " + name);
+    }
+    png.format = PNG_FORMAT_RGB;
+    Image image(png.width, png.height);
+    if (!png_image_finish_read(&png, nullptr, image.Row(0), image.Stride(), nullptr)) {
+        throw std::invalid_argument("Broken PNG " + name);
+    }
+    return image;
+}
+
+// |image| is within rounding of |reference|, decoded by libjpeg's islow IDCT with the same
+// upsampling: no sample more than 3 apart and a mean difference below 0.1.
+inline void ExpectNearReference(const Image& image, const Image& reference,
+                                const std::string& context) {
+    EXPECT(image.Width() == reference.Width() && image.Height() == reference.Height(), context);
+    if (image.Width() != reference.Width() || image.Height() != reference.Height()) {
+        return;
+    }
+    int max = 0;
+    double sum = 0;
+    for (size_t y = 0; y < image.Height(); ++y) {
+        auto row = image.RowSpan(y);
+        auto expected = reference.RowSpan(y);
+        for (size_t x = 0; x < row.size(); ++x) {
+            int diff = std::abs(row[x] - expected[x]);
+            max = std::max(max, diff);
+            sum += diff;
+        }
+    }
+    EXPECT(max <= 3, context);
+    EXPECT(sum / (image.Width() * image.Height() * 3) < 0.1, context);
+}